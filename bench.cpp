@@ -0,0 +1,384 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "textlayout.h"
+#include "hittest.h"
+#include "canvas.h"
+#include "resample.h"
+#include "convd.h"
+#include "loader.h"
+#include "perf.h"
+
+#ifdef ASTRA_CONVD
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+using namespace std;
+
+// Microbenchmarks for the SDL-free parts of the engine.
+// Usage: bench [linebreak|hittest|canvas|resample]   (no name runs everything)
+//        bench convd <socket> <file.html> [requests] [clients]
+//        bench loader <file>...   (set ASTRA_NET_DELAY_MS to add latency)
+//        bench perfcheck <baseline> <results>   (the gate in ./build.sh perf-check)
+
+double msSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// --- Line breaker: 1 MB of text ---
+void benchLineBreaker() {
+    // Fixed-width-ish metrics so the numbers measure the breaker, not a font.
+    int sourceCalls = 0;
+    GlyphSource source = {
+        [&](int font, uint32_t cp) { ++sourceCalls; return 6 + int(cp % 7) + font; },
+        [](int font) { return 20 + font * 4; },
+        [](int font) { return 16 + font * 3; },
+    };
+
+    const char* words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+                           "Astra", "renders", "text", "into", "line", "boxes", "before", "pixels"};
+    string text;
+    text.reserve(1 << 20);
+    for (unsigned i = 0; text.size() < (1u << 20); ++i) {
+        text += words[(i * 7 + i / 3) % 16];
+        text += ' ';
+    }
+
+    // Split into paragraph-sized runs, every third run bold (font 1).
+    vector<TextRun> runs;
+    for (size_t pos = 0; pos < text.size(); pos += 600) {
+        int n = int(runs.size());
+        runs.push_back({collapseWhitespace(text.substr(pos, 600)), n % 3 == 2 ? 1 : 0, 0});
+    }
+
+    TextMeasurer measurer(source);
+    for (int pass = 0; pass < 3; ++pass) {
+        auto start = chrono::steady_clock::now();
+        size_t lines = 0;
+        for (size_t r = 0; r < runs.size(); r += 8) {
+            vector<TextRun> para(runs.begin() + r, runs.begin() + min(runs.size(), r + 8));
+            lines += breakLines(para, 640, measurer).size();
+        }
+        double ms = msSince(start);
+        cout << "linebreak " << (pass == 0 ? "cold" : "warm") << ": " << text.size() / 1024 << " KB -> "
+             << lines << " lines in " << ms << " ms (" << (text.size() / 1048576.0) / (ms / 1000.0)
+             << " MB/s), glyph lookups " << sourceCalls << ", cached words " << measurer.cachedWords() << "\n";
+    }
+}
+
+// --- Hit testing: 100k boxes ---
+void benchHitTest() {
+    // A long page: lines of word-sized boxes, every line also in a block box.
+    vector<HitBox> boxes;
+    unsigned seed = 12345;
+    auto rnd = [&]() { seed = seed * 1103515245 + 12345; return int((seed >> 8) & 0xFFFF); };
+    int y = 0;
+    while (boxes.size() < 100000) {
+        int x = 50;
+        int element = int(boxes.size());
+        boxes.push_back({50, y, 700, 24, element});
+        while (x < 700 && boxes.size() < 100000) {
+            int w = 20 + rnd() % 80;
+            boxes.push_back({x, y, w, 24, int(boxes.size())});
+            x += w + 6;
+        }
+        y += 29;
+    }
+
+    auto start = chrono::steady_clock::now();
+    HitIndex index;
+    index.build(boxes);
+    double buildMs = msSince(start);
+
+    const int queries = 1000000;
+    vector<pair<int, int>> points(queries);
+    for (auto& p : points) p = {rnd() % 800, int((long long)rnd() * y / 0x10000)};
+
+    start = chrono::steady_clock::now();
+    long long found = 0;
+    for (auto& p : points) found += index.hitTest(p.first, p.second) >= 0;
+    double pointMs = msSince(start);
+
+    vector<int> hits;
+    start = chrono::steady_clock::now();
+    long long inRects = 0;
+    for (int i = 0; i < 100000; ++i) {
+        index.queryRect(points[i].first, points[i].second, 800, 600, hits);
+        inRects += hits.size();
+    }
+    double rectMs = msSince(start);
+
+    // Linear scan for comparison, on a slice of the queries.
+    start = chrono::steady_clock::now();
+    long long linear = 0;
+    for (int i = 0; i < 1000; ++i) {
+        for (auto& b : boxes) {
+            if (points[i].first >= b.x && points[i].first < b.x + b.w && points[i].second >= b.y && points[i].second < b.y + b.h) {
+                ++linear;
+                break;
+            }
+        }
+    }
+    double linearMs = msSince(start);
+
+    cout << "hittest: " << boxes.size() << " boxes, build " << buildMs << " ms\n";
+    cout << "hittest point: " << pointMs * 1e6 / queries << " ns/query (" << found << " hits)\n";
+    cout << "hittest rect 800x600: " << rectMs * 1e6 / 100000 << " ns/query (" << inRects / 100000 << " boxes avg)\n";
+    cout << "hittest linear scan: " << linearMs * 1e6 / 1000 << " ns/query (" << linear << " hits)\n";
+}
+
+// --- Canvas: span kernels and a primitive-heavy frame ---
+void benchCanvas() {
+    const int w = 1920, h = 1080;
+    vector<const SpanKernels*> impls = {&scalarKernels()};
+    if (sse2Kernels()) impls.push_back(sse2Kernels());
+    if (avx2Kernels()) impls.push_back(avx2Kernels());
+
+    // A translucent gradient-ish source image for blits.
+    vector<uint32_t> src(size_t(w) * h);
+    for (size_t i = 0; i < src.size(); ++i)
+        src[i] = packPremultiplied({uint8_t(i * 7), uint8_t(i >> 3), uint8_t(i >> 11), uint8_t(64 + i % 192)});
+
+    vector<uint32_t> reference;
+    for (const SpanKernels* k : impls) {
+        vector<uint32_t> dst(size_t(w) * h, 0xFF808080u);
+        const int passes = 20;
+        double ms[3] = {};
+        auto start = chrono::steady_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int y = 0; y < h; ++y) k->fill(&dst[size_t(y) * w], w, 0xFF336699u + p);
+        ms[0] = msSince(start);
+        start = chrono::steady_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int y = 0; y < h; ++y) k->blend(&dst[size_t(y) * w], w, 0x80402010u);
+        ms[1] = msSince(start);
+        start = chrono::steady_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (int y = 0; y < h; ++y) k->blit(&dst[size_t(y) * w], &src[size_t(y) * w], w, p % 2 ? 255 : 200);
+        ms[2] = msSince(start);
+
+        double mpx = double(w) * h * passes / 1e6;
+        cout << "canvas kernels " << k->name << ": fill " << mpx / ms[0] << " Gpx/s, blend " << mpx / ms[1]
+             << " Gpx/s, blit " << mpx / ms[2] << " Gpx/s";
+        if (reference.empty()) reference = dst;
+        else cout << (dst == reference ? " (matches scalar)" : " (MISMATCH vs scalar)");
+        cout << "\n";
+    }
+
+    // 5000 rects, 2000 lines and 200 paths on an 800x600 canvas per frame.
+    for (const SpanKernels* k : impls) {
+        Canvas canvas(800, 600);
+        canvas.kernels = k;
+        unsigned seed = 99;
+        auto rnd = [&](int n) { seed = seed * 1103515245 + 12345; return float((seed >> 8) % unsigned(n)); };
+        const int frames = 20;
+        auto start = chrono::steady_clock::now();
+        for (int f = 0; f < frames; ++f) {
+            canvas.clearRect(0, 0, 800, 600);
+            for (int i = 0; i < 5000; ++i) {
+                canvas.fillStyle = {uint8_t(i), uint8_t(i * 3), uint8_t(i * 7), uint8_t(i % 2 ? 255 : 128)};
+                canvas.fillRect(rnd(800), rnd(600), 4 + rnd(40), 4 + rnd(40));
+            }
+            canvas.lineWidth = 2;
+            for (int i = 0; i < 2000; ++i) {
+                canvas.beginPath();
+                canvas.moveTo(rnd(800), rnd(600));
+                canvas.lineTo(rnd(800), rnd(600));
+                canvas.stroke();
+            }
+            for (int i = 0; i < 200; ++i) {
+                canvas.beginPath();
+                float cx = rnd(800), cy = rnd(600);
+                for (int v = 0; v < 6; ++v) canvas.lineTo(cx + rnd(60) - 30, cy + rnd(60) - 30);
+                canvas.fill();
+            }
+        }
+        double ms = msSince(start) / frames;
+        cout << "canvas frame " << k->name << ": 7200 primitives in " << ms << " ms (" << 1000.0 / ms << " fps)\n";
+    }
+}
+
+// --- Image resampling: a 12 MP photo shown at 800x600 ---
+void benchResample() {
+    ImagePixels photo;
+    photo.w = 4000;
+    photo.h = 3000;
+    photo.pixels.resize(size_t(photo.w) * photo.h);
+    for (size_t i = 0; i < photo.pixels.size(); ++i)
+        photo.pixels[i] = packPremultiplied({uint8_t(i * 13), uint8_t(i >> 4), uint8_t(i >> 12), uint8_t(128 + i % 128)});
+
+    vector<uint32_t> reference;
+    for (bool simd : {false, true}) {
+        vector<uint32_t> out(800 * 600);
+        auto start = chrono::steady_clock::now();
+        resampleBox(photo.pixels.data(), photo.w, photo.h, out.data(), 800, 600, simd);
+        double ms = msSince(start);
+        cout << "resample " << (simd && &bestKernels() != &scalarKernels() ? "sse2" : "scalar") << ": 4000x3000 -> 800x600 in " << ms << " ms";
+        if (reference.empty()) reference = out;
+        else cout << (out == reference ? " (matches scalar)" : " (MISMATCH vs scalar)");
+        cout << "\n";
+    }
+
+    ImagePixels shown;
+    shown.w = 800;
+    shown.h = 600;
+    shown.pixels = reference;
+    auto start = chrono::steady_clock::now();
+    auto chain = buildMipChain(shown, 3, 16);
+    double ms = msSince(start);
+    size_t bytes = 0;
+    for (const auto& level : chain) bytes += level.pixels.size() * 4;
+    cout << "resample mips: " << chain.size() << " levels in " << ms << " ms, " << (bytes >> 10) << " KB of textures vs "
+         << (photo.pixels.size() * 4 >> 10) << " KB at native size\n";
+}
+
+// --- conv daemon: load generator against "conv --serve <socket>" ---
+void printLatencies(const string& label, vector<double> ms) {
+    sort(ms.begin(), ms.end());
+    auto pct = [&](double p) { return ms[min(ms.size() - 1, size_t(p * ms.size()))]; };
+    cout << label << ": " << ms.size() << " requests, p50 " << pct(0.50) << " ms, p99 " << pct(0.99)
+         << " ms, max " << ms.back() << " ms\n";
+}
+
+void benchConvDaemon(const string& socketPath, const string& htmlPath, int requests, int clients) {
+#ifdef ASTRA_CONVD
+    ifstream file(htmlPath);
+    if (!file.is_open()) {
+        cerr << "Failed to open file: " << htmlPath << "\n";
+        return;
+    }
+    stringstream buffer;
+    buffer << file.rdbuf();
+    ConvRequest req{false, htmlPath, buffer.str()};
+
+    // Every client sends its share back to back, one connection per request
+    // like "conv --client" does.
+    vector<vector<double>> perClient(clients);
+    atomic<int> failures{0};
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            string ab, error;
+            for (int i = c; i < requests; i += clients) {
+                auto t = chrono::steady_clock::now();
+                if (!convViaDaemon(socketPath, req, ab, error)) {
+                    if (failures++ == 0) cerr << "convd: " << error << "\n";
+                    continue;
+                }
+                perClient[c].push_back(msSince(t));
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double total = msSince(start);
+
+    vector<double> all;
+    for (auto& v : perClient) all.insert(all.end(), v.begin(), v.end());
+    if (all.empty()) return;
+    printLatencies("convd " + to_string(clients) + " clients", all);
+    cout << "convd throughput: " << all.size() / (total / 1000.0) << " pages/s, " << failures << " failed\n";
+
+    // The same page through a fresh "./conv --force" process per request.
+    vector<double> spawned;
+    for (int i = 0; i < min(requests, 50); ++i) {
+        char* args[] = {(char*)"./conv", (char*)"--force", (char*)htmlPath.c_str(), nullptr};
+        posix_spawn_file_actions_t quiet;
+        posix_spawn_file_actions_init(&quiet);
+        posix_spawn_file_actions_addopen(&quiet, 1, "/dev/null", O_WRONLY, 0);
+        auto t = chrono::steady_clock::now();
+        pid_t pid;
+        int status = 0;
+        bool ok = posix_spawn(&pid, "./conv", &quiet, nullptr, args, environ) == 0 && waitpid(pid, &status, 0) == pid;
+        posix_spawn_file_actions_destroy(&quiet);
+        if (!ok || status != 0) break;
+        spawned.push_back(msSince(t));
+    }
+    if (!spawned.empty()) printLatencies("conv process per page", spawned);
+#else
+    cerr << "bench convd needs Unix domain sockets\n";
+#endif
+}
+
+// --- Resource loader: fetching a page's files one by one vs in parallel ---
+void benchLoader(const vector<string>& urls) {
+    auto start = chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (const auto& url : urls) {
+        string out, error;
+        if (fetchResource(url, out, error)) bytes += out.size();
+        else cerr << "loader: " << error << "\n";
+    }
+    double sequential = msSince(start);
+
+    ResourceLoader loader;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < urls.size(); ++i) {
+        loader.request(ResourceKind::Stylesheet, urls[i], double(i));
+        loader.request(ResourceKind::Stylesheet, urls[i], double(i));   // a page naming it twice
+    }
+    while (loader.busy()) this_thread::sleep_for(chrono::microseconds(200));
+    double parallel = msSince(start);
+    ResourceLoader::Stats stats = loader.stats();
+
+    cout << "loader sequential: " << urls.size() << " files, " << (bytes >> 10) << " KB in " << sequential << " ms\n";
+    cout << "loader parallel: " << stats.done << " fetched (" << stats.deduped << " deduped) on " << loader.threads()
+         << " threads in " << parallel << " ms\n";
+}
+
+int main(int argc, char* argv[]) {
+    string only = argc > 1 ? argv[1] : "";
+    if (only == "convd") {
+        if (argc < 4) {
+            cerr << "Usage: " << argv[0] << " convd <socket> <file.html> [requests] [clients]\n";
+            return 1;
+        }
+        benchConvDaemon(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 2000, argc > 5 ? max(1, atoi(argv[5])) : 8);
+        return 0;
+    }
+    if (only == "loader") {
+        if (argc < 3) {
+            cerr << "Usage: " << argv[0] << " loader <file>...\n";
+            return 1;
+        }
+        benchLoader(vector<string>(argv + 2, argv + argc));
+        return 0;
+    }
+    if (only == "perfcheck") {
+        if (argc != 4) {
+            cerr << "Usage: " << argv[0] << " perfcheck <baseline> <results>\n";
+            return 1;
+        }
+        ifstream baselineFile(argv[2]), resultsFile(argv[3]);
+        if (!baselineFile.is_open() || !resultsFile.is_open()) {
+            cerr << "Failed to open " << (baselineFile.is_open() ? argv[3] : argv[2]) << "\n";
+            return 1;
+        }
+        string baseHost, host;
+        auto baseline = readPerfResults(baselineFile, &baseHost), results = readPerfResults(resultsFile, &host);
+        bool sameHost = baseHost == host;
+        if (!sameHost)
+            cout << "Baseline host: " << (baseHost.empty() ? "unknown" : baseHost) << "\nThis host:     " << host
+                 << "\nTimes are shown but only instruction counts can fail.\n";
+        int regressions = comparePerf(baseline, results, cout, sameHost);
+        if (regressions < 0) return 1;
+        cout << (regressions ? "Regressions in " + to_string(regressions) + " phases" : string("No regressions")) << "\n";
+        return regressions ? 1 : 0;
+    }
+    if (only.empty() || only == "linebreak") benchLineBreaker();
+    if (only.empty() || only == "hittest") benchHitTest();
+    if (only.empty() || only == "canvas") benchCanvas();
+    if (only.empty() || only == "resample") benchResample();
+    return 0;
+}
@@ -1,4 +1,4 @@
-g++ render.cpp -o render.exe ^
+g++ -std=c++20 render.cpp -o render.exe ^
    -IC:/SDL2/SDL2-2.32.8/x86_64-w64-mingw32/include/SDL2 ^
    -IC:/SDL2/SDL2_image-2.6.0/x86_64-w64-mingw32/include/SDL2 ^
    -IC:/SDL2/SDL2_ttf-2.22.0/x86_64-w64-mingw32/include/SDL2 ^
@@ -9,4 +9,6 @@ g++ render.cpp -o render.exe ^
    
 g++ conv.cpp -o conv.exe
 
+g++ -O2 bench.cpp -o bench.exe
+
 echo Build complete!
\ No newline at end of file
@@ -1,9 +1,42 @@
 #!/bin/bash
 
-g++ render.cpp -o render \
+g++ -std=c++20 render.cpp -o render \
     -I/usr/include/SDL2 \
-    -lSDL2 -lSDL2_image -lSDL2_ttf
+    -lSDL2 -lSDL2_image -lSDL2_ttf -pthread
 
-g++ conv.cpp -o conv
+g++ conv.cpp -o conv -pthread
+
+g++ -O2 bench.cpp -o bench -pthread
 
 echo "Build complete!"
+
+# ./build.sh perf-check runs the pages in perf/corpus through conv and a
+# headless render and fails if any phase got slower than perf/baseline.txt
+# allows; ./build.sh perf-baseline records a new baseline instead. Set
+# ASTRA_PERF_RUNS for more or fewer runs per page (default 11). Where render
+# did not build (no SDL) only conv is timed. Both files start with the host
+# they ran on: against another host's baseline only instruction counts fail,
+# and the check fails outright if that leaves nothing to compare.
+if [ "$1" = "perf-check" ] || [ "$1" = "perf-baseline" ]; then
+    set -o pipefail
+    unset ASTRA_NET_DELAY_MS
+    runs=${ASTRA_PERF_RUNS:-11}
+    results=perf/results.txt
+    cache=$(mktemp -d)   # every check starts from an empty disk cache
+    trap 'rm -rf "$cache"' EXIT
+    have_render=1
+    [ -x ./render ] || { echo "render is not built (it needs SDL2): timing conv only"; have_render=; }
+    echo "host $(uname -m) $(sed -n 's/^model name[[:space:]]*: *//p' /proc/cpuinfo | head -n 1)" > "$results"
+    for page in perf/corpus/*.html; do
+        ./conv --perf "$runs" "$page" | grep '^perf ' >> "$results" || exit 1
+        [ -n "$have_render" ] || continue
+        ASTRA_CACHE_DIR="$cache" SDL_VIDEODRIVER=dummy ./render --perf "$runs" "${page%.html}.ab" \
+            | grep '^perf ' >> "$results" || exit 1
+    done
+    if [ "$1" = "perf-baseline" ]; then
+        { echo "# name median-ms MAD-ms median-instructions (0: no counter); written by ./build.sh perf-baseline"; cat "$results"; } > perf/baseline.txt
+        echo "Baseline saved to perf/baseline.txt"
+    else
+        ./bench perfcheck perf/baseline.txt "$results"
+    fi
+fi
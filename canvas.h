@@ -0,0 +1,565 @@
+#pragma once
+
+// Software 2D canvas for <canvas>: a premultiplied RGBA framebuffer, the span
+// kernels everything is drawn with, and a small scanline rasterizer for the
+// script ops (rects, paths, lines, drawImage).
+//
+// Every primitive ends up as horizontal spans handed to one of three
+// kernels: fill (opaque colour), blend (translucent colour, source-over) and
+// blit (an image row, source-over). Each kernel has a scalar, an SSE2 and an
+// AVX2 version producing identical pixels; the best one the CPU supports is
+// picked at startup (ASTRA_SIMD=scalar|sse2|avx2 overrides it).
+//
+// Pixels are uint32_t with bytes R, G, B, A in memory (SDL_PIXELFORMAT_RGBA32)
+// and colour already multiplied by alpha.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "colour.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ASTRA_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Rounded x / 255 for x <= 255 * 255; the SIMD kernels use the same formula.
+inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+inline uint32_t packPremultiplied(Rgba c, float alpha = 1.0f) {
+    uint32_t a = uint32_t(std::lround(std::clamp(alpha, 0.0f, 1.0f) * c.a));
+    return div255(c.r * a) | (div255(c.g * a) << 8) | (div255(c.b * a) << 16) | (a << 24);
+}
+
+// --- Span kernels ---
+
+struct SpanKernels {
+    const char* name;
+    void (*fill)(uint32_t* dst, int n, uint32_t colour);                       // opaque colour
+    void (*blend)(uint32_t* dst, int n, uint32_t colour);                      // premultiplied colour over dst
+    void (*blit)(uint32_t* dst, const uint32_t* src, int n, uint32_t alpha);   // src row over dst, scaled by alpha
+};
+
+namespace canvas_detail {
+
+inline uint32_t overScalar(uint32_t src, uint32_t dst) {
+    uint32_t inv = 255 - (src >> 24);
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        out |= (((src >> shift) & 0xFF) + div255(((dst >> shift) & 0xFF) * inv)) << shift;
+    return out;
+}
+
+inline uint32_t scaleScalar(uint32_t c, uint32_t alpha) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) out |= div255(((c >> shift) & 0xFF) * alpha) << shift;
+    return out;
+}
+
+inline void fillScalar(uint32_t* dst, int n, uint32_t colour) {
+    for (int i = 0; i < n; ++i) dst[i] = colour;
+}
+
+inline void blendScalar(uint32_t* dst, int n, uint32_t colour) {
+    for (int i = 0; i < n; ++i) dst[i] = overScalar(colour, dst[i]);
+}
+
+inline void blitScalar(uint32_t* dst, const uint32_t* src, int n, uint32_t alpha) {
+    if (alpha == 255) {
+        for (int i = 0; i < n; ++i) dst[i] = overScalar(src[i], dst[i]);
+    } else {
+        for (int i = 0; i < n; ++i) dst[i] = overScalar(scaleScalar(src[i], alpha), dst[i]);
+    }
+}
+
+#ifdef ASTRA_X86_SIMD
+
+// 8 x 16-bit lanes: (x * m) / 255, rounded like div255.
+inline __m128i mulDiv255(__m128i x, __m128i m) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, m), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// 255 - alpha, broadcast to the four channel lanes of each of the 2 pixels.
+inline __m128i invAlpha(__m128i px16) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_sub_epi16(_mm_set1_epi16(255), a);
+}
+
+inline void fillSse2(uint32_t* dst, int n, uint32_t colour) {
+    __m128i c = _mm_set1_epi32(int(colour));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), c);
+    for (; i < n; ++i) dst[i] = colour;
+}
+
+inline void blendSse2(uint32_t* dst, int n, uint32_t colour) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i src = _mm_set1_epi32(int(colour));
+    __m128i inv = invAlpha(_mm_unpacklo_epi8(src, zero));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i lo = mulDiv255(_mm_unpacklo_epi8(d, zero), inv);
+        __m128i hi = mulDiv255(_mm_unpackhi_epi8(d, zero), inv);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi8(src, _mm_packus_epi16(lo, hi)));
+    }
+    for (; i < n; ++i) dst[i] = overScalar(colour, dst[i]);
+}
+
+inline void blitSse2(uint32_t* dst, const uint32_t* src, int n, uint32_t alpha) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i ga = _mm_set1_epi16(short(alpha));
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+        if (alpha != 255) {
+            slo = mulDiv255(slo, ga);
+            shi = mulDiv255(shi, ga);
+        }
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i lo = _mm_add_epi16(slo, mulDiv255(_mm_unpacklo_epi8(d, zero), invAlpha(slo)));
+        __m128i hi = _mm_add_epi16(shi, mulDiv255(_mm_unpackhi_epi8(d, zero), invAlpha(shi)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blitScalar(dst + i, src + i, n - i, alpha);
+}
+
+__attribute__((target("avx2"))) inline __m256i mulDiv255x2(__m256i x, __m256i m) {
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, m), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2"))) inline __m256i invAlphax2(__m256i px16) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+}
+
+__attribute__((target("avx2"))) inline void fillAvx2(uint32_t* dst, int n, uint32_t colour) {
+    __m256i c = _mm256_set1_epi32(int(colour));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), c);
+    for (; i < n; ++i) dst[i] = colour;
+}
+
+__attribute__((target("avx2"))) inline void blendAvx2(uint32_t* dst, int n, uint32_t colour) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i src = _mm256_set1_epi32(int(colour));
+    __m256i inv = invAlphax2(_mm256_unpacklo_epi8(src, zero));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i lo = mulDiv255x2(_mm256_unpacklo_epi8(d, zero), inv);
+        __m256i hi = mulDiv255x2(_mm256_unpackhi_epi8(d, zero), inv);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi8(src, _mm256_packus_epi16(lo, hi)));
+    }
+    for (; i < n; ++i) dst[i] = overScalar(colour, dst[i]);
+}
+
+__attribute__((target("avx2"))) inline void blitAvx2(uint32_t* dst, const uint32_t* src, int n, uint32_t alpha) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ga = _mm256_set1_epi16(short(alpha));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+        if (alpha != 255) {
+            slo = mulDiv255x2(slo, ga);
+            shi = mulDiv255x2(shi, ga);
+        }
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i lo = _mm256_add_epi16(slo, mulDiv255x2(_mm256_unpacklo_epi8(d, zero), invAlphax2(slo)));
+        __m256i hi = _mm256_add_epi16(shi, mulDiv255x2(_mm256_unpackhi_epi8(d, zero), invAlphax2(shi)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    blitScalar(dst + i, src + i, n - i, alpha);
+}
+
+#endif // ASTRA_X86_SIMD
+
+} // namespace canvas_detail
+
+inline const SpanKernels& scalarKernels() {
+    static const SpanKernels k = {"scalar", canvas_detail::fillScalar, canvas_detail::blendScalar, canvas_detail::blitScalar};
+    return k;
+}
+
+// nullptr when the CPU (or the build target) lacks the instruction set.
+inline const SpanKernels* sse2Kernels() {
+#ifdef ASTRA_X86_SIMD
+    static const SpanKernels k = {"sse2", canvas_detail::fillSse2, canvas_detail::blendSse2, canvas_detail::blitSse2};
+    if (__builtin_cpu_supports("sse2")) return &k;
+#endif
+    return nullptr;
+}
+
+inline const SpanKernels* avx2Kernels() {
+#ifdef ASTRA_X86_SIMD
+    static const SpanKernels k = {"avx2", canvas_detail::fillAvx2, canvas_detail::blendAvx2, canvas_detail::blitAvx2};
+    if (__builtin_cpu_supports("avx2")) return &k;
+#endif
+    return nullptr;
+}
+
+inline const SpanKernels& bestKernels() {
+    static const SpanKernels* best = [] {
+        const char* want = getenv("ASTRA_SIMD");
+        std::string w = want ? want : "";
+        if (w == "scalar") return &scalarKernels();
+        if (w == "sse2" && sse2Kernels()) return sse2Kernels();
+        if (w.empty() || w == "avx2") {
+            if (avx2Kernels()) return avx2Kernels();
+        }
+        if (sse2Kernels()) return sse2Kernels();
+        return &scalarKernels();
+    }();
+    return *best;
+}
+
+// --- Canvas ---
+
+struct CanvasPoint {
+    float x, y;
+};
+
+class Canvas {
+public:
+    Canvas(int w = 300, int h = 150) { resize(w, h); }
+
+    void resize(int w, int h) {
+        width = std::max(1, w);
+        height = std::max(1, h);
+        pixels.assign(size_t(width) * height, 0);
+        path.clear();
+        closed.clear();
+        dirty = true;
+    }
+
+    // State, as in CanvasRenderingContext2D.
+    Rgba fillStyle = {0, 0, 0, 255};
+    Rgba strokeStyle = {0, 0, 0, 255};
+    float lineWidth = 1.0f;
+    float globalAlpha = 1.0f;
+
+    void clearRect(float x, float y, float w, float h) {
+        int x0, y0, x1, y1;
+        if (!clipRect(x, y, w, h, x0, y0, x1, y1)) return;
+        for (int row = y0; row < y1; ++row) kernels->fill(&pixels[size_t(row) * width + x0], x1 - x0, 0);
+        dirty = true;
+    }
+
+    void fillRect(float x, float y, float w, float h) {
+        int x0, y0, x1, y1;
+        if (!clipRect(x, y, w, h, x0, y0, x1, y1)) return;
+        uint32_t colour = packPremultiplied(fillStyle, globalAlpha);
+        for (int row = y0; row < y1; ++row) span(row, x0, x1, colour);
+        dirty = true;
+    }
+
+    void strokeRect(float x, float y, float w, float h) {
+        auto savedPath = std::move(path);
+        auto savedClosed = std::move(closed);
+        path.clear();
+        closed.clear();
+        rect(x, y, w, h);
+        stroke();
+        path = std::move(savedPath);
+        closed = std::move(savedClosed);
+    }
+
+    void beginPath() { path.clear(); closed.clear(); }
+    void moveTo(float x, float y) { path.push_back({{x, y}}); closed.push_back(false); }
+    void lineTo(float x, float y) {
+        if (path.empty()) moveTo(x, y);
+        else path.back().push_back({x, y});
+    }
+    void closePath() {
+        if (path.empty()) return;
+        closed.back() = true;
+        CanvasPoint start = path.back().front();
+        moveTo(start.x, start.y);   // drawing continues from the subpath start
+    }
+    void rect(float x, float y, float w, float h) {
+        moveTo(x, y);
+        lineTo(x + w, y);
+        lineTo(x + w, y + h);
+        lineTo(x, y + h);
+        closePath();
+    }
+
+    // Non-zero fill of every subpath (implicitly closed).
+    void fill() {
+        uint32_t colour = packPremultiplied(fillStyle, globalAlpha);
+        if (path.size() == 1 && isConvex(path[0])) fillConvex(path[0], colour);
+        else fillPolygons(path, colour);
+        dirty = true;
+    }
+
+    // Each segment becomes a quad lineWidth wide, with a square over every
+    // joint. All quads are wound the same way, so the non-zero union paints
+    // overlaps once even with translucent colours.
+    void stroke() {
+        std::vector<std::vector<CanvasPoint>> quads;
+        float hw = std::max(lineWidth, 0.01f) / 2;
+        for (size_t s = 0; s < path.size(); ++s) {
+            const auto& pts = path[s];
+            size_t segments = pts.size() - 1 + (closed[s] && pts.size() > 2 ? 1 : 0);
+            for (size_t i = 0; i < segments; ++i) {
+                CanvasPoint a = pts[i], b = pts[(i + 1) % pts.size()];
+                float dx = b.x - a.x, dy = b.y - a.y;
+                float len = std::sqrt(dx * dx + dy * dy);
+                if (len <= 0) continue;
+                float nx = -dy / len * hw, ny = dx / len * hw;
+                quads.push_back({{a.x + nx, a.y + ny}, {b.x + nx, b.y + ny}, {b.x - nx, b.y - ny}, {a.x - nx, a.y - ny}});
+                if (i + 1 < segments || closed[s])
+                    quads.push_back({{b.x - hw, b.y - hw}, {b.x + hw, b.y - hw}, {b.x + hw, b.y + hw}, {b.x - hw, b.y + hw}});
+            }
+        }
+        for (auto& q : quads) {
+            float area = 0;
+            for (size_t i = 0; i < q.size(); ++i) {
+                const CanvasPoint &p = q[i], &n = q[(i + 1) % q.size()];
+                area += p.x * n.y - n.x * p.y;
+            }
+            if (area < 0) std::reverse(q.begin(), q.end());
+        }
+        uint32_t colour = packPremultiplied(strokeStyle, globalAlpha);
+        if (quads.size() == 1) fillConvex(quads[0], colour);
+        else fillPolygons(quads, colour);
+        dirty = true;
+    }
+
+    // Draw premultiplied `src` (sw x sh) into the rectangle dx,dy,dw,dh with
+    // nearest-neighbour scaling.
+    void drawImage(const uint32_t* src, int sw, int sh, float dx, float dy, float dw, float dh) {
+        if (!src || sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) return;
+        int x0, y0, x1, y1;
+        if (!clipRect(dx, dy, dw, dh, x0, y0, x1, y1)) return;
+        uint32_t alpha = uint32_t(std::lround(std::clamp(globalAlpha, 0.0f, 1.0f) * 255));
+        // Copy rows as they are only when the image lands on whole pixels at
+        // its own width; the span is clamped to the source row either way.
+        int ix = int(std::lround(dx));
+        bool unscaled = dw == float(sw) && dx == float(ix);
+        if (unscaled) {
+            x0 = std::max(x0, ix);
+            x1 = std::min(x1, ix + sw);
+            if (x0 >= x1) return;
+        }
+        rowScratch.resize(size_t(x1 - x0));
+        for (int row = y0; row < y1; ++row) {
+            int sy = std::min(sh - 1, int((row + 0.5f - dy) * sh / dh));
+            const uint32_t* srcRow = src + size_t(sy) * sw;
+            const uint32_t* line;
+            if (unscaled) {
+                line = srcRow + (x0 - ix);
+            } else {
+                for (int x = x0; x < x1; ++x)
+                    rowScratch[x - x0] = srcRow[std::min(sw - 1, int((x + 0.5f - dx) * sw / dw))];
+                line = rowScratch.data();
+            }
+            kernels->blit(&pixels[size_t(row) * width + x0], line, x1 - x0, alpha);
+        }
+        dirty = true;
+    }
+
+    int width = 0, height = 0;
+    std::vector<uint32_t> pixels;
+    bool dirty = true;                       // pixels changed since the last upload
+    const SpanKernels* kernels = &bestKernels();
+
+private:
+    bool clipRect(float x, float y, float w, float h, int& x0, int& y0, int& x1, int& y1) const {
+        if (w < 0) { x += w; w = -w; }
+        if (h < 0) { y += h; h = -h; }
+        x0 = std::max(0, int(std::lround(x)));
+        y0 = std::max(0, int(std::lround(y)));
+        x1 = std::min(width, int(std::lround(x + w)));
+        y1 = std::min(height, int(std::lround(y + h)));
+        return x0 < x1 && y0 < y1;
+    }
+
+    static int ceilToInt(float v) {
+        int i = int(v);
+        return i + (float(i) < v);
+    }
+
+    void span(int row, int x0, int x1, uint32_t colour) {
+        uint32_t* dst = &pixels[size_t(row) * width + x0];
+        if (x1 - x0 < 4 && (colour >> 24) == 255) {
+            // Thin spans (strokes): not worth a kernel call.
+            for (int i = 0; i < x1 - x0; ++i) dst[i] = colour;
+            return;
+        }
+        if ((colour >> 24) == 255) kernels->fill(dst, x1 - x0, colour);
+        else if (colour >> 24) kernels->blend(dst, x1 - x0, colour);
+    }
+
+    static bool isConvex(const std::vector<CanvasPoint>& poly) {
+        int sign = 0;
+        for (size_t i = 0; i < poly.size(); ++i) {
+            const CanvasPoint &a = poly[i], &b = poly[(i + 1) % poly.size()], &c = poly[(i + 2) % poly.size()];
+            float cross = (b.x - a.x) * (c.y - b.y) - (b.y - a.y) * (c.x - b.x);
+            int s = (cross > 0) - (cross < 0);
+            if (s == 0) continue;
+            if (sign != 0 && s != sign) return false;
+            sign = s;
+        }
+        return true;
+    }
+
+    // A convex polygon covers one span per row, so each edge just widens the
+    // [left, right) of the rows it crosses: no sorting, no winding.
+    void fillConvex(const std::vector<CanvasPoint>& poly, uint32_t colour) {
+        float minY = poly[0].y, maxY = poly[0].y;
+        for (const auto& p : poly) { minY = std::min(minY, p.y); maxY = std::max(maxY, p.y); }
+        int rowStart = std::max(0, ceilToInt(minY - 0.5f));
+        int rowEnd = std::min(height, ceilToInt(maxY - 0.5f));
+        if (rowStart >= rowEnd) return;
+        rowLeft.assign(size_t(rowEnd - rowStart), 1e30f);
+        rowRight.assign(size_t(rowEnd - rowStart), -1e30f);
+        for (size_t i = 0; i < poly.size(); ++i) {
+            CanvasPoint a = poly[i], b = poly[(i + 1) % poly.size()];
+            if (a.y == b.y) continue;
+            if (a.y > b.y) std::swap(a, b);
+            float slope = (b.x - a.x) / (b.y - a.y);
+            int r0 = std::max(rowStart, ceilToInt(a.y - 0.5f));
+            int r1 = std::min(rowEnd, ceilToInt(b.y - 0.5f));
+            for (int row = r0; row < r1; ++row) {
+                float x = a.x + (row + 0.5f - a.y) * slope;
+                rowLeft[row - rowStart] = std::min(rowLeft[row - rowStart], x);
+                rowRight[row - rowStart] = std::max(rowRight[row - rowStart], x);
+            }
+        }
+        for (int row = rowStart; row < rowEnd; ++row) {
+            float l = rowLeft[row - rowStart], r = rowRight[row - rowStart];
+            if (l > r) continue;
+            int x0 = std::max(0, ceilToInt(l - 0.5f));
+            int x1 = std::min(width, ceilToInt(r - 0.5f));
+            if (x0 < x1) span(row, x0, x1, colour);
+        }
+    }
+
+    // Scanline fill sampled at pixel centres, non-zero winding. Edges are
+    // sorted by their top so each row only looks at the ones that can cross
+    // it; crossings per row are few, so they are insertion sorted.
+    void fillPolygons(const std::vector<std::vector<CanvasPoint>>& polys, uint32_t colour) {
+        edgeStore.clear();
+        for (const auto& poly : polys) {
+            for (size_t i = 0; i < poly.size(); ++i) {
+                CanvasPoint a = poly[i], b = poly[(i + 1) % poly.size()];
+                if (a.y == b.y) continue;
+                int dir = a.y < b.y ? 1 : -1;
+                if (dir < 0) std::swap(a, b);
+                edgeStore.push_back({a.x, a.y, b.y, (b.x - a.x) / (b.y - a.y), dir});
+            }
+        }
+        if (edgeStore.empty()) return;
+        std::sort(edgeStore.begin(), edgeStore.end(), [](const StoredEdge& a, const StoredEdge& b) { return a.y0 < b.y0; });
+
+        float maxY = edgeStore[0].y1;
+        for (const auto& e : edgeStore) maxY = std::max(maxY, e.y1);
+        int rowStart = std::max(0, int(std::floor(edgeStore[0].y0)));
+        int rowEnd = std::min(height, int(std::ceil(maxY)));
+        active.clear();
+        size_t next = 0;
+        for (int row = rowStart; row < rowEnd; ++row) {
+            float yc = row + 0.5f;
+            while (next < edgeStore.size() && edgeStore[next].y0 <= yc) active.push_back(int(next++));
+            crossings.clear();
+            size_t kept = 0;
+            for (int idx : active) {
+                const StoredEdge& e = edgeStore[idx];
+                if (e.y1 <= yc) continue;
+                active[kept++] = idx;
+                Crossing c = {e.x0 + (yc - e.y0) * e.slope, e.dir};
+                size_t k = crossings.size();
+                crossings.push_back(c);
+                while (k > 0 && crossings[k - 1].x > c.x) { crossings[k] = crossings[k - 1]; --k; }
+                crossings[k] = c;
+            }
+            active.resize(kept);
+            int winding = 0;
+            for (size_t i = 0; i + 1 < crossings.size(); ++i) {
+                winding += crossings[i].dir;
+                if (winding == 0) continue;
+                int x0 = std::max(0, ceilToInt(crossings[i].x - 0.5f));
+                int x1 = std::min(width, ceilToInt(crossings[i + 1].x - 0.5f));
+                if (x0 < x1) span(row, x0, x1, colour);
+            }
+        }
+    }
+
+    struct Crossing { float x; int dir; };
+    struct StoredEdge { float x0, y0, y1, slope; int dir; };
+
+    std::vector<std::vector<CanvasPoint>> path;
+    std::vector<bool> closed;                 // per subpath of `path`
+    std::vector<StoredEdge> edgeStore;
+    std::vector<int> active;                  // edgeStore indices crossing the current row
+    std::vector<Crossing> crossings;
+    std::vector<float> rowLeft, rowRight;    // fillConvex spans
+    std::vector<uint32_t> rowScratch;
+};
+
+// --- Script ops ---
+
+// Pixels for drawImage's path argument: premultiplied, w x h, or nullptr if
+// the image cannot be loaded.
+using CanvasImageSource = std::function<const uint32_t*(const std::string& path, int& w, int& h)>;
+
+// Run one op as conv writes it: "<name> <args>", e.g. "fillRect 0 0 10 10",
+// "fillStyle #ff0000" or "drawImage cat.png 0 0 64 64". Returns false for
+// unknown ops and bad arguments.
+inline bool runCanvasOp(Canvas& c, const std::string& op, const CanvasImageSource& image) {
+    std::istringstream in(op);
+    std::string name, path;
+    in >> name;
+    if (name == "fillStyle" || name == "strokeStyle") {
+        std::string value;
+        std::getline(in, value);
+        Rgba colour;
+        if (!parseColour(value, colour)) return false;
+        (name == "fillStyle" ? c.fillStyle : c.strokeStyle) = colour;
+        return true;
+    }
+    if (name == "drawImage" && !(in >> path)) return false;
+
+    std::vector<float> a;
+    float v;
+    while (in >> v) a.push_back(v);
+    if (!in.eof()) return false;   // a non-numeric argument
+
+    auto args = [&](size_t n) { return a.size() == n; };
+    if (name == "fillRect" && args(4)) c.fillRect(a[0], a[1], a[2], a[3]);
+    else if (name == "clearRect" && args(4)) c.clearRect(a[0], a[1], a[2], a[3]);
+    else if (name == "strokeRect" && args(4)) c.strokeRect(a[0], a[1], a[2], a[3]);
+    else if (name == "rect" && args(4)) c.rect(a[0], a[1], a[2], a[3]);
+    else if (name == "moveTo" && args(2)) c.moveTo(a[0], a[1]);
+    else if (name == "lineTo" && args(2)) c.lineTo(a[0], a[1]);
+    else if (name == "beginPath" && args(0)) c.beginPath();
+    else if (name == "closePath" && args(0)) c.closePath();
+    else if (name == "fill" && args(0)) c.fill();
+    else if (name == "stroke" && args(0)) c.stroke();
+    else if (name == "lineWidth" && args(1)) c.lineWidth = a[0];
+    else if (name == "globalAlpha" && args(1)) c.globalAlpha = a[0];
+    else if (name == "drawImage" && (args(2) || args(4))) {
+        int w = 0, h = 0;
+        const uint32_t* pixels = image ? image(path, w, h) : nullptr;
+        if (!pixels) return false;
+        c.drawImage(pixels, w, h, a[0], a[1], args(4) ? a[2] : float(w), args(4) ? a[3] : float(h));
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+// CSS colour parsing shared by conv and render.
+//
+// Accepts named colours (a constexpr perfect-hash table), #rgb, #rgba,
+// #rrggbb, #rrggbbaa, rgb() and rgba(), comma or space separated, with
+// optional "/ alpha" and percentages. Nothing here allocates; bad input
+// returns false instead of throwing.
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "phash.h"
+
+struct Rgba {
+    uint8_t r, g, b, a;
+};
+
+struct NamedColour {
+    std::string_view name;
+    uint32_t rgb;
+};
+
+constexpr std::array<NamedColour, 149> kNamedColours = {{
+    {"aliceblue", 0xF0F8FF}, {"antiquewhite", 0xFAEBD7}, {"aqua", 0x00FFFF}, {"aquamarine", 0x7FFFD4},
+    {"azure", 0xF0FFFF}, {"beige", 0xF5F5DC}, {"bisque", 0xFFE4C4}, {"black", 0x000000},
+    {"blanchedalmond", 0xFFEBCD}, {"blue", 0x0000FF}, {"blueviolet", 0x8A2BE2}, {"brown", 0xA52A2A},
+    {"burlywood", 0xDEB887}, {"cadetblue", 0x5F9EA0}, {"chartreuse", 0x7FFF00}, {"chocolate", 0xD2691E},
+    {"coral", 0xFF7F50}, {"cornflowerblue", 0x6495ED}, {"cornsilk", 0xFFF8DC}, {"crimson", 0xDC143C},
+    {"cyan", 0x00FFFF}, {"darkblue", 0x00008B}, {"darkcyan", 0x008B8B}, {"darkgoldenrod", 0xB8860B},
+    {"darkgray", 0xA9A9A9}, {"darkgreen", 0x006400}, {"darkgrey", 0xA9A9A9}, {"darkkhaki", 0xBDB76B},
+    {"darkmagenta", 0x8B008B}, {"darkolivegreen", 0x556B2F}, {"darkorange", 0xFF8C00}, {"darkorchid", 0x9932CC},
+    {"darkred", 0x8B0000}, {"darksalmon", 0xE9967A}, {"darkseagreen", 0x8FBC8F}, {"darkslateblue", 0x483D8B},
+    {"darkslategray", 0x2F4F4F}, {"darkslategrey", 0x2F4F4F}, {"darkturquoise", 0x00CED1}, {"darkviolet", 0x9400D3},
+    {"deeppink", 0xFF1493}, {"deepskyblue", 0x00BFFF}, {"dimgray", 0x696969}, {"dimgrey", 0x696969},
+    {"dodgerblue", 0x1E90FF}, {"firebrick", 0xB22222}, {"floralwhite", 0xFFFAF0}, {"forestgreen", 0x228B22},
+    {"fuchsia", 0xFF00FF}, {"gainsboro", 0xDCDCDC}, {"ghostwhite", 0xF8F8FF}, {"gold", 0xFFD700},
+    {"goldenrod", 0xDAA520}, {"gray", 0x808080}, {"green", 0x008000}, {"greenyellow", 0xADFF2F},
+    {"grey", 0x808080}, {"honeydew", 0xF0FFF0}, {"hotpink", 0xFF69B4}, {"indianred", 0xCD5C5C},
+    {"indigo", 0x4B0082}, {"ivory", 0xFFFFF0}, {"khaki", 0xF0E68C}, {"lavender", 0xE6E6FA},
+    {"lavenderblush", 0xFFF0F5}, {"lawngreen", 0x7CFC00}, {"lemonchiffon", 0xFFFACD}, {"lightblue", 0xADD8E6},
+    {"lightcoral", 0xF08080}, {"lightcyan", 0xE0FFFF}, {"lightgoldenrodyellow", 0xFAFAD2}, {"lightgray", 0xD3D3D3},
+    {"lightgreen", 0x90EE90}, {"lightgrey", 0xD3D3D3}, {"lightpink", 0xFFB6C1}, {"lightsalmon", 0xFFA07A},
+    {"lightseagreen", 0x20B2AA}, {"lightskyblue", 0x87CEFA}, {"lightslategray", 0x778899}, {"lightslategrey", 0x778899},
+    {"lightsteelblue", 0xB0C4DE}, {"lightyellow", 0xFFFFE0}, {"lime", 0x00FF00}, {"limegreen", 0x32CD32},
+    {"linen", 0xFAF0E6}, {"magenta", 0xFF00FF}, {"maroon", 0x800000}, {"mediumaquamarine", 0x66CDAA},
+    {"mediumblue", 0x0000CD}, {"mediumorchid", 0xBA55D3}, {"mediumpurple", 0x9370DB}, {"mediumseagreen", 0x3CB371},
+    {"mediumslateblue", 0x7B68EE}, {"mediumspringgreen", 0x00FA9A}, {"mediumturquoise", 0x48D1CC}, {"mediumvioletred", 0xC71585},
+    {"midnightblue", 0x191970}, {"mintcream", 0xF5FFFA}, {"mistyrose", 0xFFE4E1}, {"moccasin", 0xFFE4B5},
+    {"navajowhite", 0xFFDEAD}, {"navy", 0x000080}, {"oldlace", 0xFDF5E6}, {"olive", 0x808000},
+    {"olivedrab", 0x6B8E23}, {"orange", 0xFFA500}, {"orangered", 0xFF4500}, {"orchid", 0xDA70D6},
+    {"palegoldenrod", 0xEEE8AA}, {"palegreen", 0x98FB98}, {"paleturquoise", 0xAFEEEE}, {"palevioletred", 0xDB7093},
+    {"papayawhip", 0xFFEFD5}, {"peachpuff", 0xFFDAB9}, {"peru", 0xCD853F}, {"pink", 0xFFC0CB},
+    {"plum", 0xDDA0DD}, {"powderblue", 0xB0E0E6}, {"purple", 0x800080}, {"rebeccapurple", 0x663399},
+    {"red", 0xFF0000}, {"rosybrown", 0xBC8F8F}, {"royalblue", 0x4169E1}, {"saddlebrown", 0x8B4513},
+    {"salmon", 0xFA8072}, {"sandybrown", 0xF4A460}, {"seagreen", 0x2E8B57}, {"seashell", 0xFFF5EE},
+    {"sienna", 0xA0522D}, {"silver", 0xC0C0C0}, {"skyblue", 0x87CEEB}, {"slateblue", 0x6A5ACD},
+    {"slategray", 0x708090}, {"slategrey", 0x708090}, {"snow", 0xFFFAFA}, {"springgreen", 0x00FF7F},
+    {"steelblue", 0x4682B4}, {"tan", 0xD2B48C}, {"teal", 0x008080}, {"thistle", 0xD8BFD8},
+    {"tomato", 0xFF6347}, {"transparent", 0x000000}, {"turquoise", 0x40E0D0}, {"violet", 0xEE82EE},
+    {"wheat", 0xF5DEB3}, {"white", 0xFFFFFF}, {"whitesmoke", 0xF5F5F5}, {"yellow", 0xFFFF00},
+    {"yellowgreen", 0x9ACD32},
+}};
+
+constexpr std::array<std::string_view, kNamedColours.size()> namedColourKeys() {
+    std::array<std::string_view, kNamedColours.size()> keys{};
+    for (size_t i = 0; i < kNamedColours.size(); ++i) keys[i] = kNamedColours[i].name;
+    return keys;
+}
+
+constexpr auto kNamedColourHash = buildPerfectHash<256, 64>(namedColourKeys());
+
+static_assert(kNamedColourHash.find("rebeccapurple") >= 0 && kNamedColourHash.find("notacolour") < 0,
+              "named colour table is broken");
+
+namespace colour_detail {
+
+constexpr char lower(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+constexpr int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = lower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+constexpr bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+constexpr std::string_view trimmed(std::string_view s) {
+    while (!s.empty() && isSpace(s.front())) s.remove_prefix(1);
+    while (!s.empty() && isSpace(s.back())) s.remove_suffix(1);
+    return s;
+}
+
+constexpr uint8_t clampByte(double v) {
+    return v <= 0 ? 0 : v >= 255 ? 255 : uint8_t(v + 0.5);
+}
+
+// Parse a decimal number (optionally followed by %) from the front of s.
+constexpr bool number(std::string_view& s, double& value, bool& percent) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+')) negative = s[i++] == '-';
+    double v = 0;
+    bool digits = false;
+    while (i < s.size() && s[i] >= '0' && s[i] <= '9') { v = v * 10 + (s[i++] - '0'); digits = true; }
+    if (i < s.size() && s[i] == '.') {
+        ++i;
+        double scale = 0.1;
+        while (i < s.size() && s[i] >= '0' && s[i] <= '9') { v += (s[i++] - '0') * scale; scale /= 10; digits = true; }
+    }
+    if (!digits) return false;
+    percent = i < s.size() && s[i] == '%';
+    if (percent) ++i;
+    value = negative ? -v : v;
+    s.remove_prefix(i);
+    return true;
+}
+
+constexpr bool parseHex(std::string_view s, Rgba& out) {
+    int d[8] = {};
+    if (s.size() != 3 && s.size() != 4 && s.size() != 6 && s.size() != 8) return false;
+    for (size_t i = 0; i < s.size(); ++i)
+        if ((d[i] = hexDigit(s[i])) < 0) return false;
+    if (s.size() <= 4) {
+        out = {uint8_t(d[0] * 17), uint8_t(d[1] * 17), uint8_t(d[2] * 17), uint8_t(s.size() == 4 ? d[3] * 17 : 255)};
+    } else {
+        out = {uint8_t(d[0] * 16 + d[1]), uint8_t(d[2] * 16 + d[3]), uint8_t(d[4] * 16 + d[5]),
+               uint8_t(s.size() == 8 ? d[6] * 16 + d[7] : 255)};
+    }
+    return true;
+}
+
+// Body of rgb(...) / rgba(...), without the parentheses.
+constexpr bool parseRgbArgs(std::string_view s, Rgba& out) {
+    double v[4] = {0, 0, 0, 1};
+    int count = 0;
+    while (count < 4) {
+        s = trimmed(s);
+        if (s.empty()) break;
+        if (count > 0 && (s.front() == ',' || s.front() == '/')) s = trimmed(s.substr(1));
+        bool percent = false;
+        if (!number(s, v[count], percent)) return false;
+        if (count < 3) v[count] = percent ? v[count] * 2.55 : v[count];
+        else v[count] = percent ? v[count] / 100 : v[count];
+        ++count;
+    }
+    if (count < 3 || !trimmed(s).empty()) return false;
+    out = {clampByte(v[0]), clampByte(v[1]), clampByte(v[2]), clampByte(v[3] * 255)};
+    return true;
+}
+
+} // namespace colour_detail
+
+// Parse a CSS colour value. Returns false (leaving `out` alone) on anything
+// it does not understand.
+constexpr bool parseColour(std::string_view text, Rgba& out) {
+    using namespace colour_detail;
+    std::string_view s = trimmed(text);
+    if (s.empty()) return false;
+    if (s.front() == '#') return parseHex(s.substr(1), out);
+
+    // Lower-case into a fixed buffer; the longest name is 20 characters.
+    char buf[32] = {};
+    size_t n = 0;
+    while (n < s.size() && n < sizeof(buf) && s[n] != '(') { buf[n] = lower(s[n]); ++n; }
+    std::string_view head(buf, n);
+
+    if (n < s.size() && s[n] == '(') {
+        if (head != "rgb" && head != "rgba") return false;
+        if (s.back() != ')') return false;
+        return parseRgbArgs(s.substr(n + 1, s.size() - n - 2), out);
+    }
+    if (n != s.size()) return false;
+
+    int idx = kNamedColourHash.find(head);
+    if (idx < 0) return false;
+    uint32_t rgb = kNamedColours[idx].rgb;
+    out = {uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb), uint8_t(head == "transparent" ? 0 : 255)};
+    return true;
+}
@@ -1,12 +1,25 @@
 #include <iostream>
+#include <charconv>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <regex>
 #include <vector>
+#include <cstdio>
+#include <thread>
+
+#include "diskcache.h"
+#include "colour.h"
+#include "tags.h"
+#include "convd.h"
+#include "jsconv.h"
+#include "perf.h"
 
 using namespace std;
 
+// Bumped whenever the .ab output changes, so older outputs are regenerated.
+const uint64_t kConvVersion = 7;
+
 // Trim whitespace
 string trim(const string& str) {
     size_t first = str.find_first_not_of(" \t\n\r");
@@ -15,55 +28,54 @@ string trim(const string& str) {
     return str.substr(first, last - first + 1);
 }
 
-// Very basic mapping: HTML tag -> Tcl command
-string htmlTagToCommand(const string& tag) {
-    if (tag == "h1") return ".header";
-    if (tag == "p") return ".para";
-    if (tag == "img") return ".img";
-    if (tag == "title") return ".title";
-    if (tag == "style") return ".styles";
+// HTML tag -> .ab command, from the registry in tags.h
+string htmlTagToCommand(const string& tag, const AbCommand* cmd) {
+    if (cmd) return string(cmd->token);
     return "." + tag; // fallback
 }
 
-bool startsWith(const string& str, const string& prefix) {
-    return str.compare(0, prefix.length(), prefix) == 0;
+bool isTag(const AbCommand* cmd, Ab id) {
+    return cmd && cmd->id == id;
 }
 
-int main(int argc, char* argv[]) {
-    int counter = 1;
-    vector<string> vars;
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <file.html>" << endl;
-        return 1;
-    }
+// Leading decimal digits of `s`, 0 if there are none or they overflow.
+int parsePixels(const string& s) {
+    int value = 0;
+    auto [end, ec] = from_chars(s.data(), s.data() + s.size(), value);
+    return ec == errc() ? value : 0;
+}
 
-    ifstream file(argv[1]);
-    if (!file.is_open()) {
-        cerr << "Failed to open file: " << argv[1] << endl;
-        return 1;
-    }
+// "width: 120px; height: 80px" -> w = 120, h = 80; other units are left alone.
+void cssSize(const string& decls, int& w, int& h) {
+    static const regex sizeRegex("(?:^|[;\\s])(width|height)\\s*:\\s*(\\d+)(px)?\\s*(?:;|$)");
+    for (sregex_iterator it(decls.begin(), decls.end(), sizeRegex), end; it != end; ++it)
+        ((*it)[1] == "width" ? w : h) = parsePixels((*it)[2]);
+}
 
-    string outputFilename = argv[1];
-    size_t dotPos = outputFilename.find_last_of('.');
-    if (dotPos != string::npos) {
-        outputFilename = outputFilename.substr(0, dotPos);
-    }
-    outputFilename += ".ab";
+bool startsWith(const string& str, const string& prefix) {
+    return str.compare(0, prefix.length(), prefix) == 0;
+}
 
-    ofstream outFile(outputFilename);
-    if (!outFile.is_open()) {
-        cerr << "Failed to create output file: " << outputFilename << endl;
-        return 1;
-    }
-    outFile << "genFrom " << argv[1] << endl;
+// Identifies the HTML and the conv version that produced an .ab ("srcHash").
+string convSrcHash(const string& content) {
+    return hexKey(fnv1a(content.data(), content.size(), fnv1a(&kConvVersion, sizeof(kConvVersion))));
+}
 
-    stringstream buffer;
-    buffer << file.rdbuf();
-    string content = buffer.str();
+// Converts one HTML document to .ab on `outFile`, with diagnostics on `log`.
+// The regexes are compiled once per process and only read afterwards, so the
+// daemon runs this on several threads at once. `perf` times the steps for
+// conv --perf (scripts are part of elements).
+void convertHtml(const string& content, const string& srcName, ostream& outFile, ostream& log, PerfRecorder* perf = nullptr) {
+    int counter = 1;
+    JsTranslator scripts;
+    outFile << "genFrom " << srcName << endl;
+    outFile << "srcHash " << convSrcHash(content) << endl;
 
     // --- Step 1: Parse <style> blocks ---
+    PerfScope stylesPhase(perf, "styles");
     map<string, tuple<string,int,string>> styles; 
-    regex styleBlockRegex("([#\\w\\-]+)\\s*\\{([\\s\\S]*?)\\}");
+    map<string, pair<int,int>> cssSizes;   // "#id { width/height }", for <img>
+    static const regex styleBlockRegex("([#\\w\\-]+)\\s*\\{([\\s\\S]*?)\\}");
     smatch sbMatch;
     string::const_iterator styleStart(content.cbegin());
 
@@ -75,23 +87,39 @@ int main(int argc, char* argv[]) {
         int fontSize = 24;
         string ttf = "Arial.ttf";
 
-        regex propRegex("(color|colour|font-size|font-family)\\s*:\\s*([^;]+);?");
+        static const regex propRegex("(color|colour|font-size|font-family)\\s*:\\s*([^;]+);?");
         smatch propMatch;
         string::const_iterator propStart(block.cbegin());
         while (regex_search(propStart, block.cend(), propMatch, propRegex)) {
             string prop = propMatch[1];
             string val = propMatch[2];
-            if (prop == "color" || prop == "colour") colour = val;
-            else if (prop == "font-size") fontSize = stoi(val);
+            if (prop == "color" || prop == "colour") {
+                Rgba c;
+                if (parseColour(val, c)) colour = formatColour(c);
+                else log << "Warning: Unsupported colour " << trim(val) << " for " << targetID << endl;
+            }
+            else if (prop == "font-size") {
+                string size = trim(val);   // "20" or "20px"; keywords keep the default
+                int parsed = parsePixels(size);
+                if (parsed > 0) fontSize = parsed;
+                else log << "Warning: Unsupported font-size " << size << " for " << targetID << endl;
+            }
             else if (prop == "font-family") ttf = val + ".ttf";
             propStart = propMatch.suffix().first;
         }
 
         styles[targetID] = make_tuple(colour, fontSize, ttf);
+        if (startsWith(targetID, "#")) {
+            pair<int,int> size = {0, 0};
+            cssSize(block, size.first, size.second);
+            if (size.first || size.second) cssSizes[targetID.substr(1)] = size;
+        }
         styleStart = sbMatch.suffix().first;
     }
+    stylesPhase.stop();
 
-    regex tagRegex("<(/?)(\\w+)([^>]*)>");
+    PerfScope elementsPhase(perf, "elements");
+    static const regex tagRegex("<(/?)(\\w+)([^>]*)>");
     smatch match;
     string::const_iterator searchStart(content.cbegin());
 
@@ -119,24 +147,25 @@ int main(int argc, char* argv[]) {
         string closing = match[1];
         string tag = match[2];
         string attrs = match[3];
+        const AbCommand* cmd = abForHtml(tag);
 
         string textBefore = content.substr(searchStart - content.cbegin(), match.position());
         textBefore = trim(textBefore);
 
         if (!textBefore.empty() &&
             textBefore.find("DOCTYPE") == std::string::npos &&
-            tag != "style" &&
-            tag != "script") 
+            !isTag(cmd, Ab::Styles) &&
+            !isTag(cmd, Ab::Script))
         {
-            std::cout << "Text: " << textBefore << std::endl;
-            outFile << ".txt " << textBefore << std::endl;
+            log << "Text: " << textBefore << endl;
+            outFile << ".txt " << textBefore << endl;
         }
 
         if (closing.empty()) {
-            outFile << htmlTagToCommand(tag) << " start" << endl;
+            outFile << htmlTagToCommand(tag, cmd) << " start" << endl;
 
             string elementID;
-            regex idRegex("id=[\"']([^\"']+)[\"']", regex_constants::icase);
+            static const regex idRegex("id=[\"']([^\"']+)[\"']", regex_constants::icase);
             smatch idMatch;
             if (regex_search(attrs, idMatch, idRegex)) {
                 elementID = idMatch[1];
@@ -145,152 +174,85 @@ int main(int argc, char* argv[]) {
             }
             outFile << "ID: " << elementID << endl;
 
-            if (tag == "img") {
-                regex srcRegex("src=[\"']([^\"']+)[\"']");
+            // Inline handlers: onclick="alert('hi')" -> .on click alert hi
+            static const regex onRegex("\\bon(click|mouseenter|mouseleave)\\s*=\\s*(?:\"([^\"]*)\"|'([^']*)')", regex_constants::icase);
+            for (sregex_iterator it(attrs.begin(), attrs.end(), onRegex), end; it != end; ++it) {
+                string event = (*it)[1];
+                transform(event.begin(), event.end(), event.begin(), ::tolower);
+                string js = trim((*it)[2].matched ? (*it)[2].str() : (*it)[3].str());
+                if (startsWith(js, "alert(")) {
+                    outFile << ".on " << event << " alert " << callArgument(js.substr(6)) << endl;
+                } else if (startsWith(js, "console.log(")) {
+                    outFile << ".on " << event << " log " << callArgument(js.substr(12)) << endl;
+                } else {
+                    log << "Ignoring " << event << " handler: " << js << endl;
+                }
+            }
+
+            // <link rel="stylesheet" href="..."> is fetched by render's loader.
+            if (tag == "link") {
+                static const regex relRegex("\\brel\\s*=\\s*[\"']?stylesheet", regex_constants::icase);
+                static const regex hrefRegex("\\bhref\\s*=\\s*[\"']([^\"']+)[\"']", regex_constants::icase);
+                smatch hrefMatch;
+                if (regex_search(attrs, relRegex) && regex_search(attrs, hrefMatch, hrefRegex))
+                    outFile << ".stylesheet " << hrefMatch[1] << endl;
+            }
+
+            static const regex widthRegex("\\bwidth=[\"']?(\\d+)");
+            static const regex heightRegex("\\bheight=[\"']?(\\d+)");
+            smatch sizeMatch;
+            if (isTag(cmd, Ab::Img)) {
+                static const regex srcRegex("src=[\"']([^\"']+)[\"']");
                 smatch srcMatch;
                 if (regex_search(attrs, srcMatch, srcRegex)) {
                     outFile << ".media " << srcMatch[1] << endl;
                 }
-                regex altRegex("alt=[\"']([^\"']+)[\"']");
+                static const regex altRegex("alt=[\"']([^\"']+)[\"']");
                 smatch altMatch;
                 if (regex_search(attrs, altMatch, altRegex)) {
                     outFile << ".desc " << altMatch[1] << endl;
                 }
+                // Display size: attributes, then the #id rule, then the style
+                // attribute. 0 means "from the image" (keeping its aspect).
+                static const regex styleRegex("\\bstyle\\s*=\\s*(?:\"([^\"]*)\"|'([^']*)')", regex_constants::icase);
+                int width = regex_search(attrs, sizeMatch, widthRegex) ? parsePixels(sizeMatch[1]) : 0;
+                int height = regex_search(attrs, sizeMatch, heightRegex) ? parsePixels(sizeMatch[1]) : 0;
+                if (cssSizes.count(elementID)) {
+                    auto [cssWidth, cssHeight] = cssSizes[elementID];
+                    if (cssWidth) width = cssWidth;
+                    if (cssHeight) height = cssHeight;
+                }
+                if (regex_search(attrs, sizeMatch, styleRegex))
+                    cssSize(sizeMatch[1].matched ? sizeMatch[1].str() : sizeMatch[2].str(), width, height);
+                if (width || height) outFile << ".size " << width << " " << height << endl;
                 outFile << ".img end" << endl;
-            } else if (tag == "script") {
+            } else if (isTag(cmd, Ab::Canvas)) {
+                // Canvas pixels are sized by attributes only (300x150 default).
+                string width = regex_search(attrs, sizeMatch, widthRegex) ? sizeMatch[1].str() : "300";
+                string height = regex_search(attrs, sizeMatch, heightRegex) ? sizeMatch[1].str() : "150";
+                outFile << ".size " << width << " " << height << endl;
+            } else if (isTag(cmd, Ab::Script)) {
                 string scriptContent;
-                regex srcRegex("src=[\"']([^\"']+)[\"']");
+                static const regex srcRegex("src=[\"']([^\"']+)[\"']");
                 smatch srcMatch;
                 if (regex_search(attrs, srcMatch, srcRegex)) {
                     outFile << ".script src " << srcMatch[1] << endl;
                 } else {
                     string::const_iterator scriptStart = match.suffix().first;
                     string::const_iterator scriptEnd = content.cend();
+                    static const regex scriptEndRegex("</script>", regex_constants::icase);
                     smatch endMatch;
-                    if (regex_search(scriptStart, content.cend(), endMatch, regex("</script>", regex_constants::icase))) {
+                    if (regex_search(scriptStart, content.cend(), endMatch, scriptEndRegex)) {
                         scriptEnd = endMatch.prefix().second;
                     }
                     scriptContent = string(scriptStart, scriptEnd);
-                    scriptContent = trim(scriptContent);
-                    vector<string> lines;
-                    stringstream ss(scriptContent);
-                    string line;
-
-                    while (getline(ss, line)) {
-                        string trimmed = trim(line);
-
-                        regex consoleRegex(R"(console\.log\s*\((.*)\))");
-                        smatch cm;
-                        if (regex_search(trimmed, cm, consoleRegex)) {
-                            string logContentR = trim(cm[1]);
-                            string logContent;
-                            bool inQuotes = false;
-                            string var;
-
-                            for (char c : logContentR) {
-                                if (c == '"' || c == '\'') {
-                                    inQuotes = !inQuotes;
-                                    continue;
-                                }
-                                if (c == ')') break;
-
-                                if (inQuotes) {
-                                    logContent += c;
-                                } else {
-                                    if (isalnum(c) || c == '_') {
-                                        var += c;
-                                    } else {
-                                        if (!var.empty()) {
-                                            if (find(vars.begin(), vars.end(), var) != vars.end())
-                                                logContent += "\\$" + var;
-                                            else
-                                                cout << "Warning: Undefined variable " << var << " in console.log" << endl;
-                                                logContent += var;
-                                            var.clear();
-                                        } else if (find(vars.begin(), vars.end(), string(1, c)) != vars.end()) {
-                                            logContent += "\\$" + string(1, c);
-                                        } else {
-                                            cout  << "Warning: Undefined variable " << c << " in console.log" << endl;  
-                                            logContent += c;
-                                        }
-                                    }
-                                }
-                            }
-                            if (!var.empty()) {
-                                if (find(vars.begin(), vars.end(), var) != vars.end())
-                                    logContent += "\\$" + var;
-                                
-                                else
-                                    if (find(vars.begin(), vars.end(), var) != vars.end())
-                                        logContent += "\\$" + var;
-                                    else
-
-                                        cout << "Warning: Undefined variable " << var << " in console.log" << endl;
-                                        for (string var : vars) {
-                                            cout << "Defined variable: " << var << endl;
-                                        }
-                                        //logContent += var;
-                            }
-
-                            cout << "Found console.log: " << logContent << endl;
-                            outFile << "log " << logContent << endl;
-                        }
-
-                        else if (startsWith(trimmed, "alert")) {
-                            string logContentR = trimmed.substr(6);
-                            logContentR = trim(logContentR);
-                            string logContent;
-                            for (char c : logContentR) {
-                                if (c == '"' || c == '\'') continue;
-                                if (c == ')') break;
-                                logContent += c;
-                            }
-                            cout << "Found Alert: " << logContent << endl;
-                            outFile << "alert " << logContent << endl;
-                        }
-
-                        else if (startsWith(trimmed, "let")) {
-                            string Content = trimmed.substr(3);
-                            string Name;
-                            string Value;
-                            bool foundEqual = false;
-                            for (char c : Content) {
-                                if (c == '=') foundEqual = true;
-                                else if (!foundEqual) Name += c;
-                                else if (foundEqual && c != ';') Value += c;
-                            }
-                            Name = trim(Name);
-                            Value = trim(Value);
-                            if (startsWith(Value, "prompt(")) {
-                                string promptContent;
-                                for (char c : Value.substr(7)) {
-                                    if (c == '"' || c == '\'') continue;
-                                    if (c == ')') break;
-                                    promptContent += c;
-                                }
-                                cout << "Found prompt: " << Name << " with message: " << promptContent << endl;
-                                vars.push_back(Name);
-                                outFile << "prompt " << Name  << " " << promptContent << endl; 
-                            } else {
-                                cout << "Found variable: " << Name << " with value: " << Value << endl;
-                                vars.push_back(Name);
-                                outFile << "let " << Name << " " << Value << endl;
-                            }
-                        }
-
-                        else if (trimmed.find("function") != string::npos || trimmed.find("}") != string::npos || trimmed.find("{") != string::npos || trimmed.find("//") != string::npos || trimmed.find("if") != string::npos || trimmed.find("else") != string::npos) {
-                            // Ignore
-                        }
-
-                        else if (!trimmed.empty()) {
-                            cout << "Ignoring script line: " << trimmed << endl;
-                        }
-                    }
+                    PerfScope scriptsPhase(perf, "scripts");
+                    scripts.translate(scriptContent, outFile, log);
                 }
                 outFile << ".script end" << endl;
             }
         } else {
-            outFile << htmlTagToCommand(tag) << " end" << endl;
+            outFile << htmlTagToCommand(tag, cmd) << " end" << endl;
         }
 
         searchStart = match.suffix().first;
@@ -303,6 +265,136 @@ int main(int argc, char* argv[]) {
     }
 
     outFile << ".Doc end" << endl;
+}
+
+// A whole non-negative number, as in "--perf 11"; false for anything else.
+bool parseCount(const string& s, int& n) {
+    auto [end, ec] = from_chars(s.data(), s.data() + s.size(), n);
+    return ec == errc() && end == s.data() + s.size() && n >= 0;
+}
+
+int usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " [--client <socket>] [--force] <file.html>" << endl;
+    cerr << "       " << argv0 << " --serve <socket> [threads]" << endl;
+    cerr << "       " << argv0 << " --perf <runs> <file.html>" << endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    if (args.size() >= 2 && args[0] == "--serve") {
+        int threads = int(thread::hardware_concurrency());
+        if (args.size() >= 3 && !parseCount(args[2], threads)) return usage(argv[0]);
+        return serveConv(args[1], unsigned(threads), [](const ConvRequest& req, string& ab, string& error) {
+            string content = req.html;
+            if (req.isPath) {
+                ifstream file(req.srcName);
+                if (!file.is_open()) {
+                    error = "cannot open " + req.srcName;
+                    return false;
+                }
+                stringstream buffer;
+                buffer << file.rdbuf();
+                content = buffer.str();
+            }
+            ostringstream out;
+            ostream discard(nullptr);   // per-page diagnostics are not sent back
+            convertHtml(content, req.srcName, out, discard);
+            ab = out.str();
+            return true;
+        });
+    }
+
+    // Time the conversion for the perf gate: one warm-up and `runs` measured
+    // conversions, then write the .ab as usual.
+    if (args.size() == 3 && args[0] == "--perf") {
+        int runs = 0;
+        if (!parseCount(args[1], runs)) return usage(argv[0]);
+        runs = max(1, runs);
+        ifstream file(args[2]);
+        if (!file.is_open()) {
+            cerr << "Failed to open file: " << args[2] << endl;
+            return 1;
+        }
+        stringstream buffer;
+        buffer << file.rdbuf();
+        string content = buffer.str();
+
+        string page = args[2].substr(args[2].find_last_of("/\\") + 1);
+        PerfRecorder perf("conv/" + page.substr(0, page.find_last_of('.')));
+        ostream discard(nullptr);
+        string ab;
+        for (int run = 0; run <= runs; ++run) {
+            perf.beginRun();
+            ostringstream out;
+            PerfScope total(&perf, "total");
+            convertHtml(content, args[2], out, discard, &perf);
+            total.stop();
+            ab = out.str();
+        }
+        string outputFilename = args[2].substr(0, args[2].find_last_of('.')) + ".ab";
+        ofstream(outputFilename) << ab;
+        perf.report(cout);
+        return 0;
+    }
+
+    // Forward to a running daemon when asked to; convert here if it is not up.
+    string socketPath;
+    if (args.size() >= 2 && args[0] == "--client") {
+        socketPath = args[1];
+        args.erase(args.begin(), args.begin() + 2);
+    } else if (const char* env = getenv("ASTRA_CONV_SOCKET")) {
+        socketPath = env;
+    }
+
+    bool force = args.size() == 2 && args[0] == "--force";
+    if (args.size() != 1 && !force) return usage(argv[0]);
+    string inputFilename = args.back();
+
+    ifstream file(inputFilename);
+    if (!file.is_open()) {
+        cerr << "Failed to open file: " << inputFilename << endl;
+        return 1;
+    }
+
+    stringstream buffer;
+    buffer << file.rdbuf();
+    string content = buffer.str();
+
+    string outputFilename = inputFilename;
+    size_t dotPos = outputFilename.find_last_of('.');
+    if (dotPos != string::npos) {
+        outputFilename = outputFilename.substr(0, dotPos);
+    }
+    outputFilename += ".ab";
+
+    // Skip the conversion when the existing .ab was generated from this exact
+    // HTML by this version of conv.
+    if (!force) {
+        ifstream existing(outputFilename);
+        string genLine, hashLine;
+        if (getline(existing, genLine) && getline(existing, hashLine) && hashLine == "srcHash " + convSrcHash(content)) {
+            cout << "Up to date: " << outputFilename << endl;
+            return 0;
+        }
+    }
+
+    string ab, error;
+    if (!socketPath.empty() && convViaDaemon(socketPath, {false, inputFilename, content}, ab, error)) {
+        cout << "Converted by daemon at " << socketPath << endl;
+    } else {
+        if (!socketPath.empty()) cout << "conv daemon unavailable (" << error << "), converting locally" << endl;
+        ostringstream out;
+        convertHtml(content, inputFilename, out, cout);
+        ab = out.str();
+    }
+
+    ofstream outFile(outputFilename);
+    if (!outFile.is_open()) {
+        cerr << "Failed to create output file: " << outputFilename << endl;
+        return 1;
+    }
+    outFile << ab;
 
     cout << "Output saved to " << outputFilename << endl;
     return 0;
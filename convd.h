@@ -0,0 +1,408 @@
+#pragma once
+
+// The conv daemon: a long-running conv behind a Unix domain socket.
+//
+// Starting conv for every page pays for process startup and for compiling
+// its regexes each time. "conv --serve" keeps one process (and its compiled
+// regexes) warm and converts on a thread pool; "conv --client" or
+// ASTRA_CONV_SOCKET make conv forward to it instead of converting itself.
+//
+// A connection carries any number of requests, answered in order:
+//   "PATH <file>\n"                      convert a file the daemon can read
+//   "HTML <bytes> <srcName>\n" <bytes>   convert this HTML, named srcName
+// and each gets "OK <bytes>\n" <the .ab> or "ERR <message>\n". Pages over
+// kConvMaxHtml bytes are refused and the connection closed.
+//
+// POSIX only; on Windows the daemon and client report themselves unavailable.
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define ASTRA_CONVD 1
+#endif
+
+struct ConvRequest {
+    bool isPath = false;
+    std::string srcName;   // path to read, or the name the HTML came from
+    std::string html;      // empty for PATH requests
+};
+
+// Converts one request into .ab text; returns false with `error` set.
+using ConvHandler = std::function<bool(const ConvRequest&, std::string& ab, std::string& error)>;
+
+// Fixed set of workers draining a FIFO of jobs; the destructor finishes the
+// queued jobs and joins.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned n) {
+        for (unsigned i = 0; i < std::max(1u, n); ++i) workers.emplace_back([this] { work(); });
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void work() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#ifdef ASTRA_CONVD
+
+namespace convd_detail {
+
+inline bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= size_t(n);
+    }
+    return true;
+}
+
+// Buffered reads of header lines and fixed-size payloads from a socket.
+struct Reader {
+    explicit Reader(int fd) : fd(fd) {}
+
+    int fd;
+    std::string buf;
+    size_t pos = 0;
+
+    bool fill() {
+        if (pos > 0) {
+            buf.erase(0, pos);
+            pos = 0;
+        }
+        char chunk[16384];
+        ssize_t n;
+        do n = ::recv(fd, chunk, sizeof chunk, 0); while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        buf.append(chunk, size_t(n));
+        return true;
+    }
+
+    bool line(std::string& out) {
+        for (;;) {
+            size_t nl = buf.find('\n', pos);
+            if (nl != std::string::npos) {
+                out.assign(buf, pos, nl - pos);
+                pos = nl + 1;
+                return true;
+            }
+            if (buf.size() - pos > 4096 || !fill()) return false;   // headers are short
+        }
+    }
+
+    bool exact(size_t len, std::string& out) {
+        while (buf.size() - pos < len)
+            if (!fill()) return false;
+        out.assign(buf, pos, len);
+        pos += len;
+        return true;
+    }
+};
+
+inline int connectTo(const std::string& socketPath) {
+    sockaddr_un addr{};
+    if (socketPath.size() >= sizeof addr.sun_path) return -1;
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Largest page an HTML request may carry; its bytes are buffered whole.
+constexpr unsigned long long kConvMaxHtml = 64ull << 20;
+
+// Takes the first request off `buf`, once all of it has arrived. Returns
+// false while it is incomplete, or with `error` set if the header is too
+// long to be one or announces more than kConvMaxHtml bytes.
+inline bool takeRequest(std::string& buf, ConvRequest& req, std::string& error) {
+    size_t nl = buf.find('\n');
+    if (nl == std::string::npos) {
+        if (buf.size() > 4096) error = "bad request";   // headers are short
+        return false;
+    }
+    std::string header = buf.substr(0, nl);
+    size_t consumed = nl + 1;
+    if (header.rfind("PATH ", 0) == 0) {
+        req.isPath = true;
+        req.srcName = header.substr(5);
+    } else if (header.rfind("HTML ", 0) == 0) {
+        char* end = nullptr;
+        unsigned long long len = std::strtoull(header.c_str() + 5, &end, 10);
+        if (end && *end == ' ') req.srcName = end + 1;
+        if (len > kConvMaxHtml) {
+            error = "bad request";
+            return false;
+        }
+        if (buf.size() - consumed < len) return false;
+        req.html = buf.substr(consumed, size_t(len));
+        consumed += size_t(len);
+    } else {
+        error = "bad request";
+    }
+    buf.erase(0, consumed);
+    return true;
+}
+
+// The reply frame for one request. A page that throws fails its own
+// request, not the daemon.
+inline std::string convReply(const ConvRequest& req, std::string error, const ConvHandler& handler) {
+    std::string ab;
+    bool ok = false;
+    if (error.empty()) {
+        try {
+            ok = handler(req, ab, error);
+        } catch (const std::exception& e) {
+            error = std::string("conversion failed: ") + e.what();
+        } catch (...) {
+            error = "conversion failed";
+        }
+    }
+    return ok ? "OK " + std::to_string(ab.size()) + "\n" + ab : "ERR " + error + "\n";
+}
+
+// A client connection. The accept loop reads what it sends; while one of
+// its requests is on the pool (busy) it is not polled, so replies go out in
+// request order.
+struct Connection {
+    std::string buf;   // received, not yet taken as a request
+    bool busy = false;
+};
+
+inline volatile std::sig_atomic_t stopRequested = 0;
+inline int wakeFd = -1;   // write end of the self-pipe that wakes poll()
+
+inline void wake() {
+    int saved = errno;
+    [[maybe_unused]] ssize_t n = ::write(wakeFd, "", 1);   // a full pipe wakes poll() anyway
+    errno = saved;
+}
+
+} // namespace convd_detail
+
+// Serves requests on `socketPath` until SIGINT/SIGTERM. The accept loop
+// polls every idle connection and posts each complete request as a job on a
+// pool of `threads` workers, so idle clients hold no worker. Returns a
+// process exit code.
+inline int serveConv(const std::string& socketPath, unsigned threads, const ConvHandler& handler) {
+    using namespace convd_detail;
+    sockaddr_un addr{};
+    if (socketPath.size() >= sizeof addr.sun_path) {
+        std::fprintf(stderr, "Socket path too long: %s\n", socketPath.c_str());
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(socketPath.c_str());   // a stale socket from a killed daemon
+    int pipeFds[2] = {-1, -1};
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 ||
+        ::listen(listener, 128) != 0 || ::pipe(pipeFds) != 0) {
+        std::fprintf(stderr, "Failed to listen on %s: %s\n", socketPath.c_str(), std::strerror(errno));
+        if (listener >= 0) ::close(listener);
+        return 1;
+    }
+    for (int fd : pipeFds) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    wakeFd = pipeFds[1];
+
+    struct sigaction sa{};
+    sa.sa_handler = [](int) {
+        stopRequested = 1;
+        wake();
+    };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::map<int, Connection> connections;
+    std::mutex finishedMutex;
+    std::vector<std::pair<int, bool>> finished;   // fd, reply sent
+
+    {
+        // Workers start with the signals blocked, so they reach this thread.
+        sigset_t stopSignals, previous;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
+        ThreadPool pool(threads);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        std::printf("conv daemon listening on %s with %zu threads\n", socketPath.c_str(), pool.size());
+        std::fflush(stdout);
+
+        auto closeConnection = [&](int fd) {
+            ::close(fd);
+            connections.erase(fd);
+        };
+        // Post the next buffered request of an idle connection, if complete.
+        auto dispatch = [&](int fd) {
+            Connection& c = connections[fd];
+            ConvRequest req;
+            std::string error;
+            if (!takeRequest(c.buf, req, error)) {
+                if (!error.empty()) closeConnection(fd);
+                return;
+            }
+            c.busy = true;
+            pool.post([fd, req = std::move(req), error, &handler, &finished, &finishedMutex] {
+                std::string reply = convReply(req, error, handler);
+                bool sent = writeAll(fd, reply.data(), reply.size());
+                {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    finished.push_back({fd, sent});
+                }
+                wake();
+            });
+        };
+
+        while (!stopRequested) {
+            std::vector<pollfd> polled = {{listener, POLLIN, 0}, {pipeFds[0], POLLIN, 0}};
+            for (const auto& [fd, c] : connections)
+                if (!c.busy) polled.push_back({fd, POLLIN, 0});
+            if (::poll(polled.data(), polled.size(), -1) < 0) continue;   // EINTR: check stopRequested
+
+            if (polled[1].revents) {
+                char drain[64];
+                while (::read(pipeFds[0], drain, sizeof drain) > 0) {}
+                std::vector<std::pair<int, bool>> done;
+                {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    done.swap(finished);
+                }
+                for (auto [fd, sent] : done) {
+                    connections[fd].busy = false;
+                    if (!sent) closeConnection(fd);
+                    else dispatch(fd);   // requests sent while this one was busy
+                }
+            }
+            if (polled[0].revents & POLLIN) {
+                int fd = ::accept(listener, nullptr, nullptr);
+                if (fd >= 0) connections[fd];
+            }
+            for (size_t i = 2; i < polled.size(); ++i) {
+                if (!polled[i].revents) continue;
+                int fd = polled[i].fd;
+                char chunk[16384];
+                ssize_t n = ::recv(fd, chunk, sizeof chunk, MSG_DONTWAIT);
+                if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+                if (n <= 0) {
+                    closeConnection(fd);
+                    continue;
+                }
+                connections[fd].buf.append(chunk, size_t(n));
+                dispatch(fd);
+            }
+        }
+
+        // Workers blocked sending to a client fail instead of waiting on it.
+        for (const auto& [fd, c] : connections) ::shutdown(fd, SHUT_RDWR);
+    }
+    for (const auto& [fd, c] : connections) ::close(fd);
+    ::close(listener);
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+    ::unlink(socketPath.c_str());
+    std::printf("conv daemon stopped\n");
+    return 0;
+}
+
+// Sends one request over its own connection. Returns false with `error` set
+// if the daemon is unreachable or failed the conversion.
+inline bool convViaDaemon(const std::string& socketPath, const ConvRequest& req, std::string& ab, std::string& error) {
+    using namespace convd_detail;
+    int fd = connectTo(socketPath);
+    if (fd < 0) {
+        error = "cannot connect to " + socketPath + ": " + std::strerror(errno);
+        return false;
+    }
+    std::string msg = req.isPath ? "PATH " + req.srcName + "\n"
+                                 : "HTML " + std::to_string(req.html.size()) + " " + req.srcName + "\n" + req.html;
+    Reader in(fd);
+    std::string header;
+    bool ok = writeAll(fd, msg.data(), msg.size()) && in.line(header);
+    if (ok && header.rfind("OK ", 0) == 0) {
+        ok = in.exact(size_t(std::strtoull(header.c_str() + 3, nullptr, 10)), ab);
+        if (!ok) error = "connection closed mid-reply";
+    } else {
+        error = ok ? header.substr(header.rfind("ERR ", 0) == 0 ? 4 : 0) : "connection closed";
+        ok = false;
+    }
+    ::close(fd);
+    return ok;
+}
+
+#else
+
+inline int serveConv(const std::string&, unsigned, const ConvHandler&) {
+    std::fprintf(stderr, "The conv daemon needs Unix domain sockets; not available on this platform\n");
+    return 1;
+}
+
+inline bool convViaDaemon(const std::string&, const ConvRequest&, std::string&, std::string& error) {
+    error = "the conv daemon is not available on this platform";
+    return false;
+}
+
+#endif
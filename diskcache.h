@@ -0,0 +1,299 @@
+#pragma once
+
+// Content-hashed on-disk cache shared by conv and render.
+//
+// Each cached source file (an .ab, a PNG, ...) owns one blob named after the
+// hash of its path. A blob records the source's mtime, size and content hash;
+// it is reused while mtime and size match, or while the content hash still
+// matches after a touch. Blobs are mapped read-only on the next start and the
+// directory is trimmed oldest-first to stay under a byte budget.
+//
+// ASTRA_CACHE_DIR overrides the location, ASTRA_CACHE_MB the budget
+// (0 turns the cache off).
+//
+// lookup and store may be called from several threads (render's resource
+// loader decodes images on workers).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 64-bit FNV-1a. Not cryptographic; only used to notice changed files.
+inline uint64_t fnv1a(const void* data, size_t len, uint64_t h = 1469598103934665603ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+inline std::string hexKey(uint64_t v) {
+    static const char* digits = "0123456789abcdef";
+    std::string out(16, '0');
+    for (int i = 15; i >= 0; --i, v >>= 4) out[i] = digits[v & 0xF];
+    return out;
+}
+
+inline bool readWholeFile(const std::string& path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+inline bool hashFile(const std::string& path, uint64_t& out) {
+    std::string content;
+    if (!readWholeFile(path, content)) return false;
+    out = fnv1a(content.data(), content.size());
+    return true;
+}
+
+// Bumped whenever a blob layout changes so stale entries are ignored.
+constexpr uint32_t kCacheVersion = 1;
+
+struct CacheHeader {
+    char magic[4];          // "ABC1"
+    uint32_t version;
+    uint32_t kind;          // caller-defined blob type
+    uint32_t width, height; // free for image blobs, 0 otherwise
+    uint32_t reserved;
+    uint64_t srcMtime, srcSize, srcHash;
+    uint64_t payloadSize;
+};
+
+// Read-only view of a blob: mmap'd on POSIX, read into memory on Windows.
+class MappedBlob {
+public:
+    MappedBlob() = default;
+    MappedBlob(const MappedBlob&) = delete;
+    MappedBlob& operator=(const MappedBlob&) = delete;
+    ~MappedBlob() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#if defined(_WIN32) || defined(_WIN64)
+        if (!readWholeFile(path, copy)) return false;
+        base = reinterpret_cast<const uint8_t*>(copy.data());
+        length = copy.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) { ::close(fd); return false; }
+        void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<const uint8_t*>(p);
+        length = size_t(st.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32) || defined(_WIN64)
+        copy.clear();
+#else
+        if (base) munmap(const_cast<uint8_t*>(base), length);
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    const CacheHeader& header() const { return *reinterpret_cast<const CacheHeader*>(base); }
+    const uint8_t* payload() const { return base + sizeof(CacheHeader); }
+    size_t payloadSize() const { return header().payloadSize; }
+    bool valid() const {
+        return base && length >= sizeof(CacheHeader) && memcmp(header().magic, "ABC1", 4) == 0 &&
+               header().version == kCacheVersion && length - sizeof(CacheHeader) >= header().payloadSize;
+    }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    std::string copy;
+#endif
+};
+
+class DiskCache {
+public:
+    DiskCache() {
+        const char* mb = getenv("ASTRA_CACHE_MB");
+        maxBytes = uint64_t(mb ? atoll(mb) : 256) * 1024 * 1024;
+        if (maxBytes == 0) return;
+
+        std::error_code ec;
+        if (const char* env = getenv("ASTRA_CACHE_DIR")) dir = env;
+#if defined(_WIN32) || defined(_WIN64)
+        else if (const char* local = getenv("LOCALAPPDATA")) dir = std::filesystem::path(local) / "Astra" / "cache";
+#else
+        else if (const char* xdg = getenv("XDG_CACHE_HOME")) dir = std::filesystem::path(xdg) / "astra";
+        else if (const char* home = getenv("HOME")) dir = std::filesystem::path(home) / ".cache" / "astra";
+#endif
+        else dir = ".astra-cache";
+        std::filesystem::create_directories(dir, ec);
+        enabled = !ec;
+        if (!enabled) std::cerr << "Cache disabled: cannot create " << dir << ": " << ec.message() << std::endl;
+    }
+
+    // Map the blob cached for `source` into `out` if it is still current.
+    bool lookup(const std::string& source, uint32_t kind, MappedBlob& out) {
+        if (!enabled) return false;
+        uint64_t mtime, size;
+        if (!stamp(source, mtime, size)) return false;
+
+        std::string blobPath = entryPath(source, kind);
+        if (!out.open(blobPath) || !out.valid() || out.header().kind != kind) {
+            ++misses;
+            return false;
+        }
+
+        const CacheHeader& h = out.header();
+        if (h.srcMtime != mtime || h.srcSize != size) {
+            // Touched but maybe not changed: fall back to the content hash.
+            uint64_t hash;
+            if (h.srcSize != size || !hashFile(source, hash) || hash != h.srcHash) {
+                out.close();
+                ++misses;
+                return false;
+            }
+            restamp(blobPath, mtime);
+        }
+
+        std::error_code ec;
+        std::filesystem::last_write_time(blobPath, std::filesystem::file_time_type::clock::now(), ec); // LRU
+        ++hits;
+        return true;
+    }
+
+    // Store `payload` as the blob for `source`, then trim the directory.
+    void store(const std::string& source, uint32_t kind, const void* payload, size_t payloadSize,
+               uint32_t width = 0, uint32_t height = 0) {
+        if (!enabled) return;
+        CacheHeader h = {};
+        memcpy(h.magic, "ABC1", 4);
+        h.version = kCacheVersion;
+        h.kind = kind;
+        h.width = width;
+        h.height = height;
+        h.payloadSize = payloadSize;
+        if (!stamp(source, h.srcMtime, h.srcSize) || !hashFile(source, h.srcHash)) return;
+
+        // Write to a temporary name and rename so readers never see half a blob.
+        std::string blobPath = entryPath(source, kind);
+        static std::atomic<unsigned> tmpSeq{0};
+        std::string tmpPath = blobPath + ".tmp" + std::to_string(++tmpSeq);
+        {
+            std::ofstream outFile(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!outFile.is_open()) return;
+            outFile.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            outFile.write(static_cast<const char*>(payload), std::streamsize(payloadSize));
+            if (!outFile) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, blobPath, ec);
+        if (ec) std::filesystem::remove(tmpPath, ec);
+        trim();
+    }
+
+    // Delete least recently used blobs until the directory fits the budget.
+    void trim() {
+        std::lock_guard<std::mutex> lock(trimMutex);
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (auto& e : std::filesystem::directory_iterator(dir, ec)) {
+            if (!e.is_regular_file(ec)) continue;
+            total += e.file_size(ec);
+            entries.push_back({e.last_write_time(ec), e.path()});
+        }
+        if (total <= maxBytes) return;
+        std::sort(entries.begin(), entries.end());
+        for (auto& [time, path] : entries) {
+            if (total <= maxBytes) break;
+            uint64_t size = std::filesystem::file_size(path, ec);
+            if (std::filesystem::remove(path, ec)) total -= size;
+        }
+    }
+
+    bool enabled = false;
+    uint64_t maxBytes = 0;
+    std::atomic<int> hits{0}, misses{0};
+
+private:
+    std::string entryPath(const std::string& source, uint32_t kind) const {
+        std::error_code ec;
+        std::string abs = std::filesystem::absolute(source, ec).string();
+        return (dir / (hexKey(fnv1a(abs.data(), abs.size())) + "." + std::to_string(kind))).string();
+    }
+
+    static bool stamp(const std::string& path, uint64_t& mtime, uint64_t& size) {
+        std::error_code ec;
+        auto t = std::filesystem::last_write_time(path, ec);
+        if (ec) return false;
+        size = std::filesystem::file_size(path, ec);
+        if (ec) return false;
+        mtime = uint64_t(t.time_since_epoch().count());
+        return true;
+    }
+
+    static void restamp(const std::string& blobPath, uint64_t mtime) {
+        std::fstream f(blobPath, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(offsetof(CacheHeader, srcMtime));
+        f.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    }
+
+    std::filesystem::path dir;
+    std::mutex trimMutex;
+};
+
+inline DiskCache& diskCache() {
+    static DiskCache cache;
+    return cache;
+}
+
+// Little helpers for flat blob payloads.
+struct BlobWriter {
+    std::string bytes;
+    void u32(uint32_t v) { bytes.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void str(const std::string& s) { u32(uint32_t(s.size())); bytes += s; }
+    void raw(const void* p, size_t n) { bytes.append(static_cast<const char*>(p), n); }
+};
+
+struct BlobReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+    bool take(void* dst, size_t n) {
+        if (!ok || size_t(end - p) < n) return ok = false;
+        memcpy(dst, p, n);
+        p += n;
+        return true;
+    }
+    uint32_t u32() { uint32_t v = 0; take(&v, sizeof(v)); return v; }
+    std::string str() {
+        uint32_t n = u32();
+        if (!ok || size_t(end - p) < n) { ok = false; return ""; }
+        std::string s(reinterpret_cast<const char*>(p), n);
+        p += n;
+        return s;
+    }
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+// Spatial index from points on the page back to laid-out elements.
+//
+// A static R-tree packed with Sort-Tile-Recursive: boxes are sorted into
+// vertical slices by x, each slice by y, and cut into leaves of kFanout; the
+// same is repeated on the leaves until one root is left. It is rebuilt from
+// scratch after every layout, which is cheaper than keeping a dynamic tree
+// balanced, and answers point and rect queries in O(log n) for the mostly
+// non-overlapping boxes a page produces.
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+struct HitBox {
+    int x, y, w, h;
+    int element;   // caller's element index
+};
+
+class HitIndex {
+public:
+    void build(std::vector<HitBox> boxes) {
+        items = std::move(boxes);
+        levels.clear();
+        if (items.empty()) return;
+
+        strSort(items, [](const HitBox& b) { return b.x * 2 + b.w; }, [](const HitBox& b) { return b.y * 2 + b.h; });
+        std::vector<Node> level;
+        for (size_t i = 0; i < items.size(); i += kFanout) {
+            Node n = {INT_MAX, INT_MAX, INT_MIN, INT_MIN, int(i), int(std::min(items.size() - i, size_t(kFanout)))};
+            for (int k = 0; k < n.count; ++k) grow(n, items[i + k].x, items[i + k].y, items[i + k].x + items[i + k].w, items[i + k].y + items[i + k].h);
+            level.push_back(n);
+        }
+        levels.push_back(std::move(level));
+
+        while (levels.back().size() > 1) {
+            std::vector<Node>& children = levels.back();
+            strSort(children, [](const Node& n) { return n.x0 + n.x1; }, [](const Node& n) { return n.y0 + n.y1; });
+            std::vector<Node> parents;
+            for (size_t i = 0; i < children.size(); i += kFanout) {
+                Node n = {INT_MAX, INT_MAX, INT_MIN, INT_MIN, int(i), int(std::min(children.size() - i, size_t(kFanout)))};
+                for (int k = 0; k < n.count; ++k) grow(n, children[i + k].x0, children[i + k].y0, children[i + k].x1, children[i + k].y1);
+                parents.push_back(n);
+            }
+            levels.push_back(std::move(parents));
+        }
+    }
+
+    // Indices into boxes() of every box overlapping [x, x+w) x [y, y+h).
+    void queryRect(int x, int y, int w, int h, std::vector<int>& out) const {
+        out.clear();
+        if (levels.empty()) return;
+        const Node& root = levels.back()[0];
+        if (root.x0 < x + w && root.x1 > x && root.y0 < y + h && root.y1 > y)
+            query(int(levels.size()) - 1, 0, x, y, x + w, y + h, out);
+    }
+
+    void queryPoint(int px, int py, std::vector<int>& out) const { queryRect(px, py, 1, 1, out); }
+
+    // Element of the smallest box under (px, py), or -1. The smallest box is
+    // the most specific one, e.g. a <strong> run inside its paragraph.
+    int hitTest(int px, int py) const {
+        queryPoint(px, py, scratch);
+        int best = -1;
+        long long bestArea = LLONG_MAX;
+        for (int i : scratch) {
+            long long area = (long long)items[i].w * items[i].h;
+            if (area <= bestArea) { bestArea = area; best = items[i].element; }
+        }
+        return best;
+    }
+
+    const std::vector<HitBox>& boxes() const { return items; }
+    size_t size() const { return items.size(); }
+
+private:
+    static constexpr int kFanout = 16;
+
+    struct Node {
+        int x0, y0, x1, y1;   // bounds, exclusive max
+        int first, count;     // child range in the level below (or items)
+    };
+
+    static void grow(Node& n, int x0, int y0, int x1, int y1) {
+        n.x0 = std::min(n.x0, x0);
+        n.y0 = std::min(n.y0, y0);
+        n.x1 = std::max(n.x1, x1);
+        n.y1 = std::max(n.y1, y1);
+    }
+
+    // Pages are far taller than wide, so the number of vertical slices
+    // follows the aspect ratio of the centres instead of plain sqrt(leaves);
+    // otherwise leaves become thin strips spanning thousands of pixels.
+    template <class T, class CX, class CY>
+    static void strSort(std::vector<T>& v, CX cx, CY cy) {
+        long long minX = LLONG_MAX, maxX = LLONG_MIN, minY = LLONG_MAX, maxY = LLONG_MIN;
+        for (const T& t : v) {
+            minX = std::min<long long>(minX, cx(t));
+            maxX = std::max<long long>(maxX, cx(t));
+            minY = std::min<long long>(minY, cy(t));
+            maxY = std::max<long long>(maxY, cy(t));
+        }
+        double aspect = double(maxX - minX + 1) / double(maxY - minY + 1);
+        size_t leaves = (v.size() + kFanout - 1) / kFanout;
+        size_t slices = std::max<size_t>(1, std::min(leaves, size_t(std::lround(std::sqrt(leaves * aspect)))));
+        size_t perSlice = ((leaves + slices - 1) / slices) * kFanout;
+
+        std::sort(v.begin(), v.end(), [&](const T& a, const T& b) { return cx(a) < cx(b); });
+        for (size_t i = 0; i < v.size(); i += perSlice) {
+            auto end = v.begin() + std::min(v.size(), i + perSlice);
+            std::sort(v.begin() + i, end, [&](const T& a, const T& b) { return cy(a) < cy(b); });
+        }
+    }
+
+    void query(int level, int index, int x0, int y0, int x1, int y1, std::vector<int>& out) const {
+        const Node& n = levels[level][index];
+        if (level == 0) {
+            for (int i = n.first; i < n.first + n.count; ++i) {
+                const HitBox& b = items[i];
+                if (b.x < x1 && b.x + b.w > x0 && b.y < y1 && b.y + b.h > y0) out.push_back(i);
+            }
+            return;
+        }
+        const std::vector<Node>& below = levels[level - 1];
+        for (int i = n.first; i < n.first + n.count; ++i) {
+            const Node& c = below[i];
+            if (c.x0 < x1 && c.x1 > x0 && c.y0 < y1 && c.y1 > y0) query(level - 1, i, x0, y0, x1, y1, out);
+        }
+    }
+
+    std::vector<HitBox> items;
+    std::vector<std::vector<Node>> levels;   // levels[0] are the leaves
+    mutable std::vector<int> scratch;
+};
@@ -0,0 +1,345 @@
+#pragma once
+
+// Translation of the supported JavaScript subset into .ab script lines (the
+// lines script.h runs). conv translates inline <script> bodies with it;
+// render translates the external scripts the resource loader fetches.
+//
+// One JsTranslator per document: it remembers declared variables, canvas
+// contexts and Image objects across all of the document's scripts.
+// Diagnostics ("Found ...", "Ignoring ...") go to the `log` stream.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "colour.h"
+
+// Colours are written to the .ab as #rrggbb, or #rrggbbaa when translucent.
+inline std::string formatColour(const Rgba& c) {
+    char buf[10];
+    if (c.a == 255) std::snprintf(buf, sizeof(buf), "#%02x%02x%02x", c.r, c.g, c.b);
+    else std::snprintf(buf, sizeof(buf), "#%02x%02x%02x%02x", c.r, c.g, c.b, c.a);
+    return buf;
+}
+
+// Literal argument of a one-argument call such as alert('hi'): quotes are
+// dropped and everything after the closing paren is ignored.
+inline std::string callArgument(const std::string& args) {
+    std::string out;
+    for (char c : args) {
+        if (c == '"' || c == '\'') continue;
+        if (c == ')') break;
+        out += c;
+    }
+    return out;
+}
+
+class JsTranslator {
+public:
+    // Inline timer callbacks become ".func <prefix><n>"; documents translated
+    // separately (the page and each external script) need distinct prefixes.
+    explicit JsTranslator(std::string callbackPrefix = "callback") : prefix(std::move(callbackPrefix)) {}
+
+    void translate(const std::string& source, std::ostream& out, std::ostream& log) {
+        // Function bodies become ".func <name>" ... ".func end"; the script
+        // loop in render runs them from timers and frames.
+        static const std::regex functionRegex(R"(function\s+(\w+)\s*\([^)]*\)\s*\{)");
+        static const std::regex callbackRegex(R"((?:(?:const|let|var)\s+(\w+)\s*=\s*)?(setTimeout|setInterval|requestAnimationFrame)\s*\(\s*(?:function\s*\([^)]*\)|\(?[\w\s,]*\)?\s*=>)\s*\{)");
+        static const std::regex callbackEndRegex(R"(\}\s*(?:,\s*(\d+)\s*)?\)\s*;?)");
+        static const std::regex consoleRegex(R"(console\.log\s*\((.*)\))");
+
+        std::stringstream ss(trim(source));
+        std::string line;
+        std::vector<Block> blocks;
+        int depth = 0;
+
+        while (std::getline(ss, line)) {
+            std::string trimmed = trim(line);
+            int opens = int(std::count(trimmed.begin(), trimmed.end(), '{'));
+            int closes = int(std::count(trimmed.begin(), trimmed.end(), '}'));
+            int closedTo = depth - closes;   // before this line's opening braces
+            depth += opens - closes;
+            std::smatch cm;
+
+            if (std::regex_match(trimmed, cm, functionRegex)) {
+                out << ".func " << cm[1] << std::endl;
+                blocks.push_back({cm[1], "", "", depth});
+                log << "Found function: " << cm[1] << std::endl;
+            }
+
+            else if (std::regex_match(trimmed, cm, callbackRegex)) {
+                std::string name = prefix + std::to_string(++callbacks);
+                out << ".func " << name << std::endl;
+                blocks.push_back({name, cm[2], cm[1], depth});
+                log << "Found " << cm[2] << " callback: " << name << std::endl;
+            }
+
+            else if (!blocks.empty() && startsWith(trimmed, "}") && closedTo < blocks.back().depth) {
+                Block block = blocks.back();
+                blocks.pop_back();
+                out << ".func end" << std::endl;
+                if (block.timer == "requestAnimationFrame") {
+                    out << "raf " << block.name << std::endl;
+                } else if (!block.timer.empty()) {
+                    std::string ms = std::regex_match(trimmed, cm, callbackEndRegex) && cm[1].matched ? cm[1].str() : "0";
+                    out << (block.timer == "setTimeout" ? "timeout " : "interval ") << block.name << " " << ms;
+                    if (!block.handle.empty()) out << " " << block.handle;
+                    out << std::endl;
+                }
+            }
+
+            else if (timerLine(trimmed, out, log)) {
+                // Written (or warned about) by timerLine
+            }
+
+            else if (canvasLine(trimmed, out, log)) {
+                // Written (or warned about) by canvasLine
+            }
+
+            else if (std::regex_search(trimmed, cm, consoleRegex)) {
+                std::string logContent = logArguments(trim(cm[1]), log);
+                log << "Found console.log: " << logContent << std::endl;
+                out << "log " << logContent << std::endl;
+            }
+
+            else if (startsWith(trimmed, "alert")) {
+                std::string logContent = callArgument(trim(trimmed.substr(6)));
+                log << "Found Alert: " << logContent << std::endl;
+                out << "alert " << logContent << std::endl;
+            }
+
+            else if (startsWith(trimmed, "let")) {
+                std::string Content = trimmed.substr(3);
+                std::string Name;
+                std::string Value;
+                bool foundEqual = false;
+                for (char c : Content) {
+                    if (c == '=') foundEqual = true;
+                    else if (!foundEqual) Name += c;
+                    else if (foundEqual && c != ';') Value += c;
+                }
+                Name = trim(Name);
+                Value = trim(Value);
+                vars.push_back(Name);
+                if (startsWith(Value, "prompt(")) {
+                    std::string promptContent = callArgument(Value.substr(7));
+                    log << "Found prompt: " << Name << " with message: " << promptContent << std::endl;
+                    out << "prompt " << Name << " " << promptContent << std::endl;
+                } else {
+                    log << "Found variable: " << Name << " with value: " << Value << std::endl;
+                    out << "let " << Name << " " << Value << std::endl;
+                }
+            }
+
+            else if (trimmed.find("function") != std::string::npos || trimmed.find('}') != std::string::npos ||
+                     trimmed.find('{') != std::string::npos || trimmed.find("//") != std::string::npos ||
+                     trimmed.find("if") != std::string::npos || trimmed.find("else") != std::string::npos) {
+                // Ignore
+            }
+
+            else if (!trimmed.empty()) {
+                log << "Ignoring script line: " << trimmed << std::endl;
+            }
+        }
+        for (; !blocks.empty(); blocks.pop_back()) {
+            log << "Warning: Unclosed function " << blocks.back().name << std::endl;
+            out << ".func end" << std::endl;
+        }
+    }
+
+private:
+    static std::string trim(const std::string& str) {
+        size_t first = str.find_first_not_of(" \t\n\r");
+        if (first == std::string::npos) return "";
+        size_t last = str.find_last_not_of(" \t\n\r");
+        return str.substr(first, last - first + 1);
+    }
+
+    static bool startsWith(const std::string& str, const std::string& prefix) {
+        return str.compare(0, prefix.length(), prefix) == 0;
+    }
+
+    // A JS function body being translated into a ".func" block.
+    struct Block {
+        std::string name;
+        std::string timer;    // setTimeout/setInterval/requestAnimationFrame for inline callbacks, else ""
+        std::string handle;   // variable the timer id is assigned to, if any
+        int depth;            // brace depth inside the body
+    };
+
+    bool declared(const std::string& name) const { return std::find(vars.begin(), vars.end(), name) != vars.end(); }
+
+    // console.log arguments: quoted text is kept, declared variables become
+    // "\$name" for the script loop to substitute.
+    std::string logArguments(const std::string& args, std::ostream& log) const {
+        std::string logContent;
+        bool inQuotes = false;
+        std::string var;
+
+        for (char c : args) {
+            if (c == '"' || c == '\'') {
+                inQuotes = !inQuotes;
+                continue;
+            }
+            if (c == ')') break;
+
+            if (inQuotes) {
+                logContent += c;
+            } else if (std::isalnum((unsigned char)c) || c == '_') {
+                var += c;
+            } else if (!var.empty()) {
+                if (declared(var)) {
+                    logContent += "\\$" + var;
+                } else {
+                    log << "Warning: Undefined variable " << var << " in console.log" << std::endl;
+                    logContent += var;
+                }
+                var.clear();
+            } else if (declared(std::string(1, c))) {
+                logContent += "\\$" + std::string(1, c);
+            } else {
+                log << "Warning: Undefined variable " << c << " in console.log" << std::endl;
+                logContent += c;
+            }
+        }
+        if (!var.empty()) {
+            if (declared(var)) {
+                logContent += "\\$" + var;
+            } else {
+                log << "Warning: Undefined variable " << var << " in console.log" << std::endl;
+                for (const std::string& name : vars) log << "Defined variable: " << name << std::endl;
+            }
+        }
+        return logContent;
+    }
+
+    // Timers by function name: setTimeout(tick, 100) -> "timeout tick 100",
+    // setInterval -> "interval", requestAnimationFrame(tick) -> "raf tick",
+    // clearTimeout/clearInterval(id) -> "cancel id". Inline callbacks are
+    // handled as blocks by translate.
+    bool timerLine(const std::string& line, std::ostream& out, std::ostream& log) {
+        static const std::regex timerRegex(R"((?:(?:const|let|var)\s+(\w+)\s*=\s*)?(setTimeout|setInterval)\s*\(\s*(\w+)\s*(?:,\s*(\d+)\s*)?\)\s*;?)");
+        static const std::regex rafRegex(R"(requestAnimationFrame\s*\(\s*(\w+)\s*\)\s*;?)");
+        static const std::regex clearRegex(R"((?:clearTimeout|clearInterval)\s*\(\s*(\w+)\s*\)\s*;?)");
+        static const std::regex anyTimerRegex(R"(\b(setTimeout|setInterval|requestAnimationFrame|clearTimeout|clearInterval)\s*\()");
+        std::smatch m;
+
+        if (std::regex_match(line, m, timerRegex)) {
+            std::string ms = m[4].matched ? m[4].str() : "0";
+            out << (m[2] == "setTimeout" ? "timeout " : "interval ") << m[3] << " " << ms;
+            if (m[1].matched) out << " " << m[1];
+            out << std::endl;
+            log << "Found " << m[2] << ": " << m[3] << " every " << ms << " ms" << std::endl;
+            return true;
+        }
+        if (std::regex_match(line, m, rafRegex)) {
+            out << "raf " << m[1] << std::endl;
+            log << "Found requestAnimationFrame: " << m[1] << std::endl;
+            return true;
+        }
+        if (std::regex_match(line, m, clearRegex)) {
+            out << "cancel " << m[1] << std::endl;
+            return true;
+        }
+        if (std::regex_search(line, m, anyTimerRegex)) {
+            log << "Ignoring unsupported " << m[1] << " call: " << line << std::endl;
+            return true;
+        }
+        return false;
+    }
+
+    // Translate one line if it is canvas code: ctx.fillRect(...) becomes
+    // "draw <canvasId> fillRect ...". Returns false if the line is not about
+    // a canvas, so the other rules get a chance.
+    bool canvasLine(const std::string& line, std::ostream& out, std::ostream& log) {
+        static const std::vector<std::string> kCanvasCalls = {"fillRect", "clearRect", "strokeRect", "rect", "beginPath", "moveTo",
+                                                              "lineTo", "closePath", "fill", "stroke", "drawImage"};
+        static const std::regex elementRegex(R"((?:const|let|var)\s+(\w+)\s*=\s*document\.getElementById\(\s*["']([^"']+)["']\s*\)(\.getContext\(\s*["']2d["']\s*\))?\s*;?)");
+        static const std::regex contextRegex(R"((?:const|let|var)\s+(\w+)\s*=\s*(\w+)\.getContext\(\s*["']2d["']\s*\)\s*;?)");
+        static const std::regex imageRegex(R"((?:const|let|var)\s+(\w+)\s*=\s*new\s+Image\s*\(\s*\)\s*;?)");
+        static const std::regex srcRegex(R"((\w+)\.src\s*=\s*["']([^"']+)["']\s*;?)");
+        static const std::regex propRegex(R"((\w+)\.(fillStyle|strokeStyle|lineWidth|globalAlpha)\s*=\s*(.+?)\s*;?)");
+        static const std::regex callRegex(R"((\w+)\.(\w+)\s*\((.*)\)\s*;?)");
+        std::smatch m;
+
+        if (std::regex_match(line, m, elementRegex)) {
+            if (m[3].matched) contexts[m[1]] = m[2];
+            else canvases[m[1]] = m[2];
+            return true;
+        }
+        if (std::regex_match(line, m, contextRegex) && canvases.count(m[2])) {
+            contexts[m[1]] = canvases[m[2]];
+            return true;
+        }
+        if (std::regex_match(line, m, imageRegex)) {
+            images[m[1]] = "";
+            return true;
+        }
+        if (std::regex_match(line, m, srcRegex) && images.count(m[1])) {
+            images[m[1]] = m[2];
+            return true;
+        }
+        if (std::regex_match(line, m, propRegex) && contexts.count(m[1])) {
+            std::string value = m[3];
+            if (m[2] == "fillStyle" || m[2] == "strokeStyle") {
+                if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+                    value = value.substr(1, value.size() - 2);
+                Rgba c;
+                if (!parseColour(value, c)) {
+                    log << "Warning: Unsupported colour " << value << " for " << m[2] << std::endl;
+                    return true;
+                }
+                value = formatColour(c);
+            } else if (value.find_first_not_of("0123456789.") != std::string::npos) {
+                log << "Warning: Only literal values are supported for " << m[2] << ": " << value << std::endl;
+                return true;
+            }
+            log << "Found canvas op: " << m[2] << " " << value << std::endl;
+            out << "draw " << contexts[m[1]] << " " << m[2] << " " << value << std::endl;
+            return true;
+        }
+        if (std::regex_match(line, m, callRegex) && contexts.count(m[1])) {
+            std::string method = m[2];
+            if (std::find(kCanvasCalls.begin(), kCanvasCalls.end(), method) == kCanvasCalls.end()) {
+                log << "Ignoring unsupported canvas call: " << line << std::endl;
+                return true;
+            }
+            std::string args;
+            std::stringstream ss(m[3].str());
+            std::string arg;
+            bool first = true;
+            while (std::getline(ss, arg, ',')) {
+                arg = trim(arg);
+                if (first && method == "drawImage") {
+                    if (!images.count(arg) || images[arg].empty()) {
+                        log << "Ignoring drawImage of unknown image: " << arg << std::endl;
+                        return true;
+                    }
+                    arg = images[arg];
+                } else if (arg.empty() || arg.find_first_not_of("-0123456789.") != std::string::npos) {
+                    log << "Ignoring canvas call with non-literal arguments: " << line << std::endl;
+                    return true;
+                }
+                args += " " + arg;
+                first = false;
+            }
+            log << "Found canvas op: " << method << args << std::endl;
+            out << "draw " << contexts[m[1]] << " " << method << args << std::endl;
+            return true;
+        }
+        return false;
+    }
+
+    std::string prefix;
+    int callbacks = 0;
+    std::vector<std::string> vars;             // declared with let
+    std::map<std::string, std::string> canvases;   // JS variable -> canvas element ID
+    std::map<std::string, std::string> contexts;   // JS variable -> canvas element ID
+    std::map<std::string, std::string> images;     // JS variable -> image src
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+// Prefetching resource loader.
+//
+// render scans an .ab as soon as it is loaded for everything the page will
+// need (external scripts, images, stylesheets) and requests it all at once,
+// instead of fetching each item when layout or a script first reaches it.
+// Worker threads fetch from the local filesystem or a local HTTP server
+// (http://host:port/path) and then run the kind's hook: image decode and
+// resampling, script translation. The main thread only picks up finished
+// results, so fetching and decoding overlap with layout.
+//
+// Requests for the same resource share one fetch. Queued requests run in
+// priority order (lower first); render uses the distance from the viewport,
+// so what is on screen arrives first, and reprioritizes as layout and
+// scrolling move things.
+//
+// ASTRA_NET_DELAY_MS adds a fixed delay to every fetch, standing in for
+// network latency when measuring.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "resample.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <cerrno>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define ASTRA_HTTP 1
+#endif
+
+enum class ResourceKind : uint8_t { Script, Stylesheet, Image };
+
+inline const char* resourceKindName(ResourceKind kind) {
+    switch (kind) {
+    case ResourceKind::Script: return "script";
+    case ResourceKind::Stylesheet: return "stylesheet";
+    case ResourceKind::Image: return "image";
+    }
+    return "?";
+}
+
+struct Resource {
+    ResourceKind kind;
+    std::string url;
+    int width = 0, height = 0;   // image layout size, 0 = from the image
+
+    // Written by the worker; read only once done() is true.
+    bool ok = false;
+    std::string error;
+    std::string text;                  // script: translated .ab lines; stylesheet: the CSS
+    SharedPixels base;                 // image: at layout size, or native if smaller
+    std::vector<ImagePixels> levels;   // image: mip levels below base
+    int nativeW = 0, nativeH = 0;      // image: size before resampling
+    size_t bytes = 0;                  // fetched from disk or the network
+    double queuedMs = 0, doneMs = 0;   // loader clock
+
+    bool done() const { return finished.load(std::memory_order_acquire); }
+
+private:
+    friend class ResourceLoader;
+    std::atomic<bool> finished{false};
+    bool running = false;
+    double priority = 0;
+    uint64_t seq = 0;
+};
+
+namespace loader_detail {
+
+inline bool readFile(const std::string& path, std::string& out, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+#ifdef ASTRA_HTTP
+
+// A plain HTTP/1.0 GET, enough for a local test server such as
+// "python3 -m http.server". No TLS, redirects or chunked bodies.
+inline bool httpGet(const std::string& url, std::string& out, std::string& error) {
+    std::string rest = url.substr(7);   // after "http://"
+    size_t slash = rest.find('/');
+    std::string hostPort = rest.substr(0, slash), path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = hostPort.rfind(':');
+    std::string host = hostPort.substr(0, colon), port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+
+    addrinfo hints{}, *addrs = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+        error = "cannot resolve " + host;
+        return false;
+    }
+    int fd = -1;
+    for (addrinfo* a = addrs; a && fd < 0; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0) {
+        error = "cannot connect to " + hostPort;
+        return false;
+    }
+
+    std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + hostPort + "\r\nConnection: close\r\n\r\n";
+    std::string response;
+    bool sent = ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+    char chunk[16384];
+    for (ssize_t n; sent && ((n = ::recv(fd, chunk, sizeof chunk, 0)) > 0 || (n < 0 && errno == EINTR));)
+        if (n > 0) response.append(chunk, size_t(n));
+    ::close(fd);
+
+    size_t body = response.find("\r\n\r\n");
+    int status = 0;
+    if (body == std::string::npos || std::sscanf(response.c_str(), "HTTP/%*s %d", &status) != 1) {
+        error = "bad response from " + hostPort;
+        return false;
+    }
+    if (status != 200) {
+        error = "HTTP " + std::to_string(status) + " for " + url;
+        return false;
+    }
+    out = response.substr(body + 4);
+    return true;
+}
+
+#else
+
+inline bool httpGet(const std::string& url, std::string&, std::string& error) {
+    error = "http is not available on this platform: " + url;
+    return false;
+}
+
+#endif
+
+} // namespace loader_detail
+
+inline bool isHttpUrl(const std::string& url) { return url.rfind("http://", 0) == 0; }
+
+// Fetches `url` (a path, file:// or http://) into `out`.
+inline bool fetchResource(const std::string& url, std::string& out, std::string& error) {
+    static const int delayMs = [] {
+        const char* env = std::getenv("ASTRA_NET_DELAY_MS");
+        return env ? std::atoi(env) : 0;
+    }();
+    if (delayMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    if (isHttpUrl(url)) return loader_detail::httpGet(url, out, error);
+    return loader_detail::readFile(url.rfind("file://", 0) == 0 ? url.substr(7) : url, out, error);
+}
+
+class ResourceLoader {
+public:
+    // Runs on a worker: fetches (with fetchResource or a cache) and decodes
+    // `res`, returning false with res.error set on failure. Without a hook
+    // the bytes are fetched into res.text.
+    using Hook = std::function<bool(Resource& res)>;
+
+    struct Stats {
+        int requested = 0;   // request() calls
+        int deduped = 0;     // of those, answered by an existing resource
+        int done = 0, failed = 0;   // failed ones count as done too
+        size_t bytes = 0;
+        int pending() const { return requested - deduped - done; }
+    };
+
+    // Fetches mostly wait on I/O, so there are more workers than cores.
+    explicit ResourceLoader(unsigned threads = std::max(4u, std::min(16u, 2 * std::thread::hardware_concurrency()))) {
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back([this] { work(); });
+    }
+
+    ~ResourceLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    void setHook(ResourceKind kind, Hook hook) {
+        std::lock_guard<std::mutex> lock(mutex);
+        hooks[kind] = std::move(hook);
+    }
+
+    // The resource for (kind, url, size), queued at `priority` if new. The
+    // reference stays valid until clear().
+    Resource& request(ResourceKind kind, const std::string& url, double priority, int width = 0, int height = 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++counts.requested;
+        auto key = std::make_tuple(kind, url, width, height);
+        auto it = resources.find(key);
+        if (it != resources.end()) {
+            ++counts.deduped;
+            Resource& res = *it->second;
+            if (priority < res.priority) setPriority(res, priority);
+            return res;
+        }
+        auto owned = std::make_unique<Resource>();
+        Resource& res = *owned;
+        res.kind = kind;
+        res.url = url;
+        res.width = width;
+        res.height = height;
+        res.priority = priority;
+        res.seq = ++seq;
+        res.queuedMs = now();
+        resources.emplace(key, std::move(owned));
+        queue.insert({priority, res.seq, &res});
+        wake.notify_one();
+        return res;
+    }
+
+    Resource* find(ResourceKind kind, const std::string& url, int width = 0, int height = 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = resources.find(std::make_tuple(kind, url, width, height));
+        return it == resources.end() ? nullptr : it->second.get();
+    }
+
+    // Fetch a finished resource again (its decoded copy was evicted). It is
+    // reset and queued in place, so references to it stay valid and it is
+    // reported by drainCompleted once more when done.
+    void refetch(Resource& res, double priority) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!res.finished.load(std::memory_order_relaxed)) return;
+        completed.erase(std::remove(completed.begin(), completed.end(), &res), completed.end());
+        res.ok = false;
+        res.error.clear();
+        res.text.clear();
+        res.base = SharedPixels();
+        res.levels.clear();
+        res.nativeW = res.nativeH = 0;
+        res.bytes = 0;
+        res.finished.store(false, std::memory_order_relaxed);
+        res.priority = priority;
+        res.seq = ++seq;
+        res.queuedMs = now();
+        ++counts.requested;
+        queue.insert({priority, res.seq, &res});
+        wake.notify_one();
+    }
+
+    // Move a resource that has not started yet within the queue.
+    void reprioritize(Resource& res, double priority) {
+        std::lock_guard<std::mutex> lock(mutex);
+        setPriority(res, priority);
+    }
+
+    // Resources finished since the last call, in completion order.
+    std::vector<Resource*> drainCompleted() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Resource*> out;
+        out.swap(completed);
+        return out;
+    }
+
+    // Forget every resource (a reload); waits for the fetches in flight.
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.clear();
+        idle.wait(lock, [this] { return running == 0; });
+        resources.clear();
+        completed.clear();
+        counts = {};
+        start = std::chrono::steady_clock::now();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counts;
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !queue.empty() || running > 0;
+    }
+
+    size_t threads() const { return workers.size(); }
+
+    // Milliseconds since construction or the last clear().
+    double now() const {
+        using namespace std::chrono;
+        return duration<double, std::milli>(steady_clock::now() - start).count();
+    }
+
+private:
+    using Key = std::tuple<ResourceKind, std::string, int, int>;
+    using Entry = std::tuple<double, uint64_t, Resource*>;   // priority, then FIFO
+
+    void setPriority(Resource& res, double priority) {
+        if (res.running || res.finished.load(std::memory_order_relaxed) || priority == res.priority) return;
+        queue.erase({res.priority, res.seq, &res});
+        res.priority = priority;
+        queue.insert({priority, res.seq, &res});
+    }
+
+    void work() {
+        for (;;) {
+            Resource* res;
+            Hook hook;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                res = std::get<2>(*queue.begin());
+                queue.erase(queue.begin());
+                res->running = true;
+                ++running;
+                auto it = hooks.find(res->kind);
+                if (it != hooks.end()) hook = it->second;
+            }
+
+            if (hook) {
+                res->ok = hook(*res);
+            } else {
+                res->ok = fetchResource(res->url, res->text, res->error);
+                res->bytes = res->text.size();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                res->doneMs = now();
+                res->running = false;
+                res->finished.store(true, std::memory_order_release);
+                ++counts.done;
+                if (!res->ok) ++counts.failed;
+                counts.bytes += res->bytes;
+                completed.push_back(res);
+                --running;
+            }
+            idle.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::map<Key, std::unique_ptr<Resource>> resources;
+    std::set<Entry> queue;
+    std::vector<Resource*> completed;
+    std::map<ResourceKind, Hook> hooks;
+    Stats counts;
+    mutable std::mutex mutex;
+    std::condition_variable wake, idle;
+    int running = 0;
+    uint64_t seq = 0;
+    bool stopping = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+// Memory accounting and budgets for render's caches.
+//
+// Every subsystem that keeps memory around registers a source with the
+// accountant: how to measure its CPU and GPU bytes and, if it is a cache,
+// how to find and drop its least recently used entry. Recency is the frame
+// number an entry was last used in, so entries of different caches compare.
+//
+// enforce() runs once per frame. A pool over its own budget gives up its
+// least recently used entries first; while the total is over the overall
+// budget, the least recently used entry of any cache goes, whichever cache
+// it is in. Entries used in the current frame are never evicted; if only
+// those are left, the frame stays over budget and is counted.
+//
+// Budgets come from the environment, in MB: ASTRA_MEM_MB for the total
+// (default 512, 0 for none) and ASTRA_MEM_<POOL>_MB per pool, e.g.
+// ASTRA_MEM_IMAGES_MB=64. Pools without one only count against the total.
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+enum class MemPool : uint8_t { Fonts, Tiles, Images, Canvas, Layout, Script, Console, Count };
+
+constexpr std::array<const char*, size_t(MemPool::Count)> kMemPoolNames = {
+    "fonts", "tiles", "images", "canvas", "layout", "script", "console",
+};
+
+struct MemSource {
+    std::function<void(size_t& cpu, size_t& gpu)> measure;   // adds its bytes
+    // Caches only: the frame the least recently used entry was last used
+    // in (kNoEntry if empty), and dropping that entry.
+    std::function<uint64_t()> oldest;
+    std::function<bool()> evictOldest;
+};
+
+class MemoryAccountant {
+public:
+    static constexpr uint64_t kNoEntry = std::numeric_limits<uint64_t>::max();
+
+    struct Pool {
+        size_t cpu = 0, gpu = 0;
+        size_t budget = 0;   // 0 = only the total applies
+        size_t peak = 0;
+        int evicted = 0;
+        size_t bytes() const { return cpu + gpu; }
+    };
+
+    explicit MemoryAccountant(size_t defaultBudgetMB = 512) {
+        budget = mbFromEnv("ASTRA_MEM_MB", defaultBudgetMB);
+        for (size_t i = 0; i < pools.size(); ++i) {
+            std::string name = "ASTRA_MEM_";
+            for (const char* c = kMemPoolNames[i]; *c; ++c) name += char(std::toupper((unsigned char)*c));
+            pools[i].budget = mbFromEnv((name + "_MB").c_str(), 0);
+        }
+    }
+
+    void track(MemPool pool, MemSource source) { sources.push_back({pool, std::move(source)}); }
+
+    // A default for a pool the environment left unset.
+    void defaultBudget(MemPool pool, size_t bytes) {
+        if (!pools[size_t(pool)].budget) pools[size_t(pool)].budget = bytes;
+    }
+
+    // Re-measure every source.
+    void measure() {
+        for (auto& p : pools) p.cpu = p.gpu = 0;
+        for (auto& [pool, source] : sources) source.measure(pools[size_t(pool)].cpu, pools[size_t(pool)].gpu);
+        size_t sum = 0;
+        for (auto& p : pools) {
+            p.peak = std::max(p.peak, p.bytes());
+            sum += p.bytes();
+        }
+        totalBytes = sum;
+        peakTotal = std::max(peakTotal, sum);
+    }
+
+    // Evict until every budget holds or only entries used in `frame` are
+    // left. Returns how many entries were evicted.
+    int enforce(uint64_t frame) {
+        measure();
+        int count = 0;
+        for (;;) {
+            MemSource* victim = pickVictim(frame, true);
+            if (!victim && budget && totalBytes > budget) victim = pickVictim(frame, false);
+            if (!victim || !victim->evictOldest()) break;
+            ++pools[size_t(poolOf(victim))].evicted;
+            ++count;
+            measure();
+        }
+        if (overBudget()) ++framesOverBudget;
+        evictedTotal += count;
+        return count;
+    }
+
+    bool overBudget() const {
+        if (budget && totalBytes > budget) return true;
+        for (const auto& p : pools)
+            if (p.budget && p.bytes() > p.budget) return true;
+        return false;
+    }
+
+    const Pool& pool(MemPool p) const { return pools[size_t(p)]; }
+    size_t total() const { return totalBytes; }
+
+    // "fonts 1.2, tiles 16.0/64, ... MB; total 30.5 of 512 MB" (used/budget)
+    // for the logs and the dev console.
+    std::string summary() const {
+        std::string out;
+        char buf[96];
+        for (size_t i = 0; i < pools.size(); ++i) {
+            const Pool& p = pools[i];
+            std::snprintf(buf, sizeof buf, "%s%s %.1f", out.empty() ? "" : ", ", kMemPoolNames[i], p.bytes() / 1048576.0);
+            out += buf;
+            if (p.budget) {
+                std::snprintf(buf, sizeof buf, "/%.0f", p.budget / 1048576.0);
+                out += buf;
+            }
+        }
+        std::snprintf(buf, sizeof buf, " MB; total %.1f", totalBytes / 1048576.0);
+        out += buf;
+        if (budget) {
+            std::snprintf(buf, sizeof buf, " of %.0f", budget / 1048576.0);
+            out += buf;
+        }
+        return out + " MB";
+    }
+
+    size_t budget = 0;
+    size_t peakTotal = 0;
+    int evictedTotal = 0;
+    int framesOverBudget = 0;   // enforce() could not get under budget
+
+private:
+    static size_t mbFromEnv(const char* name, size_t fallbackMB) {
+        const char* env = std::getenv(name);
+        return size_t(env ? std::atoll(env) : fallbackMB) << 20;
+    }
+
+    MemPool poolOf(const MemSource* source) const {
+        for (const auto& [pool, s] : sources)
+            if (&s == source) return pool;
+        return MemPool::Count;
+    }
+
+    // The cache whose least recently used entry is oldest, among those in
+    // pools over their own budget (ownBudget) or all of them.
+    MemSource* pickVictim(uint64_t frame, bool ownBudget) {
+        MemSource* victim = nullptr;
+        uint64_t best = kNoEntry;
+        for (auto& [pool, source] : sources) {
+            if (!source.oldest) continue;
+            const Pool& p = pools[size_t(pool)];
+            if (ownBudget && !(p.budget && p.bytes() > p.budget)) continue;
+            uint64_t used = source.oldest();
+            if (used < frame && used < best) {
+                best = used;
+                victim = &source;
+            }
+        }
+        return victim;
+    }
+
+    std::array<Pool, size_t(MemPool::Count)> pools{};
+    std::vector<std::pair<MemPool, MemSource>> sources;
+    size_t totalBytes = 0;
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+// Per-phase timings for the performance gate (./build.sh perf-check).
+//
+// conv --perf and render --perf run one page several times and time each
+// phase of every run: wall-clock, and on Linux the user-space instructions
+// retired by the main thread (perf_event_open). The first run warms caches
+// and is dropped; the rest are reduced to the median and the median
+// absolute deviation (MAD) and printed one phase per line:
+//
+//     perf <name> <median ms> <MAD ms> <median instructions>
+//
+// comparePerf checks such lines against a committed baseline. Instruction
+// counts barely move between runs, so they get a tight threshold; time gets
+// a wider one plus a few MADs of whichever side was noisier. Where the
+// counter is unavailable (other platforms, perf_event_paranoid too high)
+// instructions are 0 and only time is compared. Both files also name the
+// machine they ran on ("host <arch> <cpu>"); time measured on another
+// machine says nothing about the code, so against such a baseline only
+// instructions can fail. A check that could compare no phase at all (such
+// a baseline without instruction counts) fails rather than passing empty.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define ASTRA_PERF_COUNTERS 1
+#endif
+
+// Regression thresholds: current > baseline * (1 + rel) + slack.
+constexpr double kPerfTimeRel = 0.10;
+constexpr double kPerfTimeMads = 3.0;          // slack: MADs of the noisier side
+constexpr double kPerfTimeFloorMs = 0.05;      // slack at least this
+constexpr double kPerfInstructionsRel = 0.02;
+constexpr double kPerfInstructionsFloor = 50000;
+
+// Instructions retired in user space by the thread that constructed it.
+class InstructionCounter {
+public:
+    InstructionCounter() {
+#ifdef ASTRA_PERF_COUNTERS
+        perf_event_attr attr{};
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~InstructionCounter() {
+#ifdef ASTRA_PERF_COUNTERS
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    InstructionCounter(const InstructionCounter&) = delete;
+    InstructionCounter& operator=(const InstructionCounter&) = delete;
+
+    bool available() const { return fd >= 0; }
+
+    // Instructions since construction, 0 if unavailable.
+    uint64_t read() const {
+        uint64_t count = 0;
+#ifdef ASTRA_PERF_COUNTERS
+        if (fd >= 0 && ::read(fd, &count, sizeof count) != ssize_t(sizeof count)) count = 0;
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+struct PerfSample {
+    double ms = 0;
+    uint64_t instructions = 0;
+};
+
+// Phase samples of repeated runs, named "<prefix>/<phase>".
+class PerfRecorder {
+public:
+    explicit PerfRecorder(std::string prefix) : prefix(std::move(prefix)) {}
+
+    void beginRun() { runs.emplace_back(); }
+
+    void add(const std::string& phase, const PerfSample& sample) {
+        if (runs.empty()) beginRun();
+        if (std::find(order.begin(), order.end(), phase) == order.end()) order.push_back(phase);
+        PerfSample& s = runs.back()[phase];
+        s.ms += sample.ms;
+        s.instructions += sample.instructions;
+    }
+
+    const InstructionCounter& counter() const { return instructions; }
+
+    // One "perf" line per phase, in the order phases first ran.
+    void report(std::ostream& out) const {
+        size_t first = runs.size() > 1 ? 1 : 0;   // warm-up
+        for (const auto& phase : order) {
+            std::vector<double> ms, ins;
+            for (size_t r = first; r < runs.size(); ++r) {
+                auto it = runs[r].find(phase);
+                PerfSample s = it == runs[r].end() ? PerfSample() : it->second;
+                ms.push_back(s.ms);
+                ins.push_back(double(s.instructions));
+            }
+            double med = median(ms);
+            std::vector<double> dev;
+            for (double m : ms) dev.push_back(std::fabs(m - med));
+            char line[256];
+            std::snprintf(line, sizeof line, "perf %s/%s %.4f %.4f %.0f\n", prefix.c_str(), phase.c_str(), med,
+                          median(dev), median(ins));
+            out << line;
+        }
+    }
+
+    static double median(std::vector<double> v) {
+        if (v.empty()) return 0;
+        std::sort(v.begin(), v.end());
+        size_t n = v.size();
+        return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    }
+
+private:
+    std::string prefix;
+    std::vector<std::string> order;
+    std::vector<std::map<std::string, PerfSample>> runs;
+    InstructionCounter instructions;
+};
+
+// Times the rest of its scope (or until stop) into `phase`; does nothing
+// without a recorder.
+class PerfScope {
+public:
+    PerfScope(PerfRecorder* recorder, const char* phase) : recorder(recorder), phase(phase) {
+        if (!recorder) return;
+        startInstructions = recorder->counter().read();
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~PerfScope() { stop(); }
+
+    // End the phase before the scope does.
+    void stop() {
+        if (!recorder) return;
+        PerfSample s;
+        s.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        s.instructions = recorder->counter().read() - startInstructions;
+        recorder->add(phase, s);
+        recorder = nullptr;
+    }
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    PerfRecorder* recorder;
+    const char* phase;
+    uint64_t startInstructions = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+// --- Baselines ---
+
+struct PerfResult {
+    double ms = 0, madMs = 0;
+    double instructions = 0;
+};
+
+// The "perf" lines of a results or baseline file; anything else is skipped.
+// `host`, if given, gets the rest of the "host" line ("" without one).
+inline std::map<std::string, PerfResult> readPerfResults(std::istream& in, std::string* host = nullptr) {
+    std::map<std::string, PerfResult> results;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string tag, name;
+        PerfResult r;
+        if (host && line.compare(0, 5, "host ") == 0) *host = line.substr(5);
+        else if (fields >> tag >> name >> r.ms >> r.madMs >> r.instructions && tag == "perf") results[name] = r;
+    }
+    return results;
+}
+
+// Prints a per-phase diff and returns the number of regressions, or -1 if
+// no phase could be checked. Phases missing from the baseline are reported
+// but do not fail; neither does time unless both sides ran on the same host.
+inline int comparePerf(const std::map<std::string, PerfResult>& baseline,
+                       const std::map<std::string, PerfResult>& current, std::ostream& out, bool sameHost = true) {
+    int regressions = 0, compared = 0;
+    char line[320];
+    std::snprintf(line, sizeof line, "%-34s %12s %12s %8s %10s %10s %8s\n", "phase", "base ms", "now ms", "time",
+                  "base Minst", "now Minst", "instr");
+    out << line;
+    for (const auto& [name, now] : current) {
+        auto it = baseline.find(name);
+        if (it == baseline.end()) {
+            std::snprintf(line, sizeof line, "%-34s %12s %12.3f %8s %10s %10.2f  new\n", name.c_str(), "-", now.ms, "", "-",
+                          now.instructions / 1e6);
+            out << line;
+            continue;
+        }
+        const PerfResult& base = it->second;
+        double timeSlack = std::max(kPerfTimeFloorMs, kPerfTimeMads * std::max(base.madMs, now.madMs));
+        bool slowerHere = now.ms > base.ms * (1 + kPerfTimeRel) + timeSlack;
+        bool slower = slowerHere && sameHost;
+        bool counted = base.instructions > 0 && now.instructions > 0;
+        bool moreWork = counted && now.instructions > base.instructions * (1 + kPerfInstructionsRel) + kPerfInstructionsFloor;
+        if (sameHost || counted) ++compared;
+
+        auto change = [](double a, double b) { return a > 0 ? (b - a) / a * 100 : 0.0; };
+        std::string verdict = slower || moreWork ? std::string("  REGRESSION (") + (moreWork ? "instructions" : "") +
+                                                       (slower && moreWork ? ", " : "") + (slower ? "time" : "") + ")"
+                              : slowerHere ? "  slower (other host)"
+                                           : "";
+        if (counted) {
+            std::snprintf(line, sizeof line, "%-34s %12.3f %12.3f %+7.1f%% %10.2f %10.2f %+7.1f%%%s\n", name.c_str(),
+                          base.ms, now.ms, change(base.ms, now.ms), base.instructions / 1e6, now.instructions / 1e6,
+                          change(base.instructions, now.instructions), verdict.c_str());
+        } else {
+            std::snprintf(line, sizeof line, "%-34s %12.3f %12.3f %+7.1f%% %10s %10s%s\n", name.c_str(), base.ms, now.ms,
+                          change(base.ms, now.ms), "-", "-", verdict.c_str());
+        }
+        out << line;
+        if (slower || moreWork) ++regressions;
+    }
+    for (const auto& [name, base] : baseline)
+        if (!current.count(name)) out << name << ": in the baseline but not measured\n";
+    if (!compared) {
+        out << (sameHost ? "No measured phase is in the baseline"
+                         : "The baseline is from another host and has no instruction counts to compare")
+            << ": nothing was checked. Record a baseline here with ./build.sh perf-baseline.\n";
+        return -1;
+    }
+    return regressions;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// Compile-time perfect hashing for small, fixed sets of string keys.
+//
+// Hash-and-displace: keys are first split into B buckets by one hash, then
+// each bucket (largest first) searches for a displacement seed that puts all
+// of its keys into free slots of an M-slot table. A lookup is two hashes, one
+// table read and one compare. The tables are built by constexpr functions,
+// so a key set that cannot be placed fails to compile instead of at runtime.
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+constexpr uint32_t phashString(std::string_view s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (char c : s) {
+        h ^= uint8_t(c);
+        h *= 16777619u;
+    }
+    // Finalizer so low bits depend on every input bit (tables are power of two).
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+template <size_t N, size_t M, size_t B>
+struct PerfectHash {
+    static_assert((M & (M - 1)) == 0, "slot count must be a power of two");
+    static_assert(N <= M, "more keys than slots");
+
+    std::array<std::string_view, N> keys{};
+    std::array<uint16_t, B> displacement{};
+    std::array<int16_t, M> slots{};
+
+    // Index of `key` in the key list, or -1.
+    constexpr int find(std::string_view key) const {
+        uint32_t bucket = phashString(key, 0) % B;
+        int idx = slots[phashString(key, displacement[bucket]) & (M - 1)];
+        return (idx >= 0 && keys[idx] == key) ? idx : -1;
+    }
+};
+
+template <size_t M, size_t B, size_t N>
+constexpr PerfectHash<N, M, B> buildPerfectHash(const std::array<std::string_view, N>& keys) {
+    PerfectHash<N, M, B> ph{};
+    ph.keys = keys;
+    for (auto& s : ph.slots) s = -1;
+
+    std::array<uint32_t, N> bucketOf{};
+    std::array<size_t, B> bucketSize{};
+    for (size_t i = 0; i < N; ++i) {
+        bucketOf[i] = phashString(keys[i], 0) % B;
+        ++bucketSize[bucketOf[i]];
+    }
+
+    // Place buckets largest first: they are the hardest to fit.
+    std::array<size_t, B> order{};
+    for (size_t b = 0; b < B; ++b) order[b] = b;
+    for (size_t i = 0; i < B; ++i)
+        for (size_t j = i + 1; j < B; ++j)
+            if (bucketSize[order[j]] > bucketSize[order[i]]) {
+                size_t t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+
+    for (size_t o = 0; o < B && bucketSize[order[o]] > 0; ++o) {
+        uint32_t bucket = uint32_t(order[o]);
+        bool placed = false;
+        for (uint32_t d = 1; d < 65536 && !placed; ++d) {
+            std::array<uint32_t, N> tried{};
+            size_t count = 0;
+            bool ok = true;
+            for (size_t i = 0; i < N && ok; ++i) {
+                if (bucketOf[i] != bucket) continue;
+                uint32_t slot = phashString(keys[i], d) & (M - 1);
+                if (ph.slots[slot] >= 0) ok = false;
+                for (size_t k = 0; k < count && ok; ++k)
+                    if (tried[k] == slot) ok = false;
+                tried[count++] = slot;
+            }
+            if (!ok) continue;
+            size_t k = 0;
+            for (size_t i = 0; i < N; ++i)
+                if (bucketOf[i] == bucket) ph.slots[tried[k++]] = int16_t(i);
+            ph.displacement[bucket] = uint16_t(d);
+            placed = true;
+        }
+        if (!placed) throw std::logic_error("perfect hash: no displacement found, grow the table");
+    }
+    return ph;
+}
@@ -9,12 +9,27 @@
 #include <map>
 #include <functional>
 #include <filesystem>
+#include <type_traits>
+#include <chrono>
 
 #include <SDL.h>
 #include <SDL_main.h>
 #include <SDL_ttf.h>
 #include <SDL_image.h>
 
+#include "textlayout.h"
+#include "diskcache.h"
+#include "hittest.h"
+#include "colour.h"
+#include "tags.h"
+#include "canvas.h"
+#include "resample.h"
+#include "script.h"
+#include "loader.h"
+#include "jsconv.h"
+#include "memory.h"
+#include "perf.h"
+
 using namespace std;
 
 
@@ -27,6 +42,9 @@ string SrcName;
 string infile;
 vector<int> executed_idxs;
 string os;
+uint64_t gFrame = 0;   // frames composited; the clock of every cache's LRU
+bool gHeadless = false; // --stress, --perf: hidden window, no message boxes, nothing waits for input
+PerfRecorder* gPerf = nullptr;   // --perf: times the phases of each frame
 
 void initOS() {
     #if defined(_WIN32) || defined(_WIN64)
@@ -41,22 +59,210 @@ void initOS() {
 }
 
 // --- Simple State Machine ---
+// Open elements, innermost last; rows of kAbCommands in tags.h.
 class State {
 private:
-    vector<string> stack;
+    vector<Ab> stack;
 public:
-    void push(const string& tag) { stack.push_back(tag); }
+    void push(Ab tag) { stack.push_back(tag); }
     void pop() { if (!stack.empty()) stack.pop_back(); }
-    string current() const { return stack.empty() ? "" : stack.back(); }
+    bool currentIs(Ab tag) const { return !stack.empty() && stack.back() == tag; }
+    bool has(Ab tag) const { return find(stack.begin(), stack.end(), tag) != stack.end(); }
+    const vector<Ab>& tags() const { return stack; }
 };
 
 // --- Style strct ---
+// Plain data, so copying a style per text run costs nothing; the font file
+// is an interned face id (see internFontFace).
 struct Style {
     SDL_Color colour; // SDL still needs SDL_Color, but field name is "colour"
-    int fontSize;
-    string ttf_path;
+    uint16_t fontSize;
+    uint8_t face;       // index into gFontFaces
+    uint8_t fontStyle;  // TTF_STYLE_BOLD inside <strong>
+};
+static_assert(is_trivially_copyable<Style>::value, "Style is copied for every text run");
+static_assert(sizeof(Style) == 8, "Style packs into 8 bytes: keep new fields narrow");
+static_assert(kFontBold == TTF_STYLE_BOLD && kFontItalic == TTF_STYLE_ITALIC, "tags.h font bits must match SDL_ttf");
+
+// Interned font file paths; face 0 is the default font. A face id is one
+// byte, so fonts past the 256th fall back to the default.
+vector<string> gFontFaces = {"Arial.ttf"};
+const uint8_t kDefaultFace = 0;
+
+uint8_t internFontFace(const string& path) {
+    for (size_t i = 0; i < gFontFaces.size(); ++i)
+        if (gFontFaces[i] == path) return uint8_t(i);
+    if (gFontFaces.size() > UINT8_MAX) {
+        cerr << "Font Error: too many fonts, using " << gFontFaces[kDefaultFace] << " for " << path << endl;
+        return kDefaultFace;
+    }
+    gFontFaces.push_back(path);
+    return uint8_t(gFontFaces.size() - 1);
+}
+
+// --- Font cache ---
+// Fonts are opened once per (face, size, style) and shared by measuring and
+// rasterizing, instead of TTF_OpenFont for every text run.
+// The memory accountant may close a font that has not been used for a
+// while; fontHandle reopens it on its next use.
+struct FontEntry {
+    TTF_Font* font; // nullptr if the file failed to open or was evicted
+    int size;
+    uint8_t face;
+    uint8_t style;
+    bool failed = false;
+    size_t bytes = 0;       // the font file, as an estimate of what FreeType holds
+    uint64_t lastUsed = 0;
+};
+
+vector<FontEntry> gFonts;
+unordered_map<uint64_t, int> gFontIds;
+
+TTF_Font* openFont(FontEntry& entry) {
+    const string& path = gFontFaces[entry.face];
+    entry.font = TTF_OpenFont(path.c_str(), entry.size);
+    if (!entry.font) {
+        cerr << "Font Error: " << TTF_GetError() << endl;
+        entry.failed = true;
+        return nullptr;
+    }
+    TTF_SetFontStyle(entry.font, entry.style);
+    error_code ec;
+    entry.bytes = size_t(filesystem::file_size(path, ec));
+    if (ec) entry.bytes = 0;
+    return entry.font;
+}
+
+int fontFor(const Style& style) {
+    uint64_t key = (uint64_t(style.face) << 32) | (uint64_t(style.fontSize) << 8) | style.fontStyle;
+    auto it = gFontIds.find(key);
+    if (it != gFontIds.end()) return it->second;
+
+    int id = int(gFonts.size());
+    gFonts.push_back({nullptr, style.fontSize, style.face, style.fontStyle});
+    openFont(gFonts.back());
+    gFontIds[key] = id;
+    return id;
+}
+
+TTF_Font* fontHandle(int f) {
+    FontEntry& entry = gFonts[f];
+    entry.lastUsed = gFrame;
+    return entry.font || entry.failed ? entry.font : openFont(entry);
+}
+
+// Glyph metrics come straight from SDL_ttf; fonts that failed to open get a
+// rough estimate so layout still makes progress.
+TextMeasurer gMeasurer({
+    [](int f, uint32_t cp) {
+        int adv = 0;
+        TTF_Font* font = fontHandle(f);
+        if (!font || TTF_GlyphMetrics32(font, cp, nullptr, nullptr, nullptr, nullptr, &adv) != 0)
+            return gFonts[f].size / 2;
+        return adv;
+    },
+    [](int f) { TTF_Font* font = fontHandle(f); return font ? TTF_FontLineSkip(font) : gFonts[f].size; },
+    [](int f) { TTF_Font* font = fontHandle(f); return font ? TTF_FontAscent(font) : gFonts[f].size; },
+});
+
+// --- Display list ---
+// exec lays the document out into a display list once; every frame only
+// paints it.
+struct DisplayItem {
+    enum Kind { Text, Image, Canvas } kind;
+    int x, y;
+    int w, h;     // bounds, for picking the tiles an item is painted into
+    string text;  // text for Text, file path for Image, element ID for Canvas
+    Style style;
+    int font;
+};
+
+struct DisplayList {
+    vector<DisplayItem> items;
+    vector<string> elements;  // element IDs, indexed by HitBox::element
+    vector<HitBox> boxes;     // laid-out rectangles of blocks, runs and images
+    int height = 0;
 };
 
+DisplayList gDisplayList;
+HitIndex gHitIndex;           // built from gDisplayList.boxes after each layout
+
+// Handlers attached to element IDs by ".on" lines; `action` is a script
+// line such as "alert hi" or "log clicked".
+struct ElementHandler {
+    string event;
+    string action;
+};
+
+unordered_map<string, vector<ElementHandler>> gElementHandlers;
+int gHoverElement = -1;
+
+// Style and owning element of one text run; TextRun::style indexes these.
+struct RunInfo {
+    Style style;
+    int element;
+};
+
+// Decoded images, resampled to their layout size and uploaded once per
+// process with a few half-size levels below it. Failed loads keep no levels
+// so they are not retried every frame.
+struct ImageLevel {
+    SDL_Texture* texture;
+    int w, h;
+};
+
+struct CachedImage {
+    vector<ImageLevel> levels;   // largest first; levels[0] is w x h
+    int w = 0, h = 0;            // layout size
+    size_t nativeBytes = 0;      // a full-resolution upload
+    size_t textureBytes = 0;     // what the levels take instead
+    // An image evicted by the memory accountant keeps its size, so layout
+    // does not move, and is fetched again when it is painted.
+    string path;
+    int requestW = 0, requestH = 0;
+    uint64_t lastUsed = 0;
+    bool evicted = false, reloading = false;
+};
+
+unordered_map<string, CachedImage> gImages;   // by imageKey()
+unordered_map<string, SharedPixels> gCanvasSources;   // drawImage sources by path
+
+const int kImageMipLevels = 3;
+const int kImageMinMipSide = 16;
+
+// Images, external scripts and stylesheets of the page, fetched and decoded
+// on worker threads (see "Resource loading"). gImageLoads maps an imageKey()
+// to its load; the resources live until the next page load clears them.
+ResourceLoader gLoader;
+unordered_map<string, Resource*> gImageLoads;
+
+// CPU and GPU bytes of every cache, against the budgets (see memory.h and
+// "Memory budgets" below).
+MemoryAccountant gMemory;
+
+// Texture bytes of the current page's images, against uploading each at its
+// native size as before.
+struct PageImageStats {
+    int images = 0;
+    size_t nativeBytes = 0, textureBytes = 0;
+} gPageImages;
+
+// <canvas> framebuffers by element ID. They outlive relayouts (only a reload
+// re-runs their draw ops); the texture is refreshed when the canvas is dirty.
+struct CanvasElement {
+    Canvas canvas;
+    SDL_Texture* texture = nullptr;
+    bool straightAlpha = false;   // renderer lacks the premultiplied blend mode
+};
+
+unordered_map<string, CanvasElement> gCanvases;
+
+// The loaded document; Refresh replaces these and asks for a new layout.
+vector<string> gLines;
+unordered_map<string, Style> gStyles;
+bool gNeedsLayout = true;   // re-run exec before the next paint
+bool gRunScripts = true;    // next exec is a (re)load, so scripts run
+
 // Dev Tools structs and functions
 // Context menu items
 struct MenuItem {
@@ -91,13 +297,14 @@ bool initSDL() {
 
     gWindow = SDL_CreateWindow("Astra Render",
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        800, 600, (gHeadless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | SDL_WINDOW_RESIZABLE);
     if (!gWindow) {
         cerr << "Window Error: " << SDL_GetError() << endl;
         return false;
     }
 
-    gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED);
+    // Headless runs rasterize in software, so timings do not depend on a GPU.
+    gRenderer = SDL_CreateRenderer(gWindow, -1, gHeadless ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED);
     if (!gRenderer) {
         cerr << "Renderer Error: " << SDL_GetError() << endl;
         return false;
@@ -106,7 +313,20 @@ bool initSDL() {
     return true;
 }
 
+void releaseTiles();
+
 void cleanupSDL() {
+    gLoader.clear();   // no decode may still be running at IMG_Quit
+    gCanvasSources.clear();
+    for (auto& [key, img] : gImages)
+        for (auto& level : img.levels) if (level.texture) SDL_DestroyTexture(level.texture);
+    gImages.clear();
+    for (auto& [id, el] : gCanvases) if (el.texture) SDL_DestroyTexture(el.texture);
+    gCanvases.clear();
+    releaseTiles();
+    for (auto& f : gFonts) if (f.font) TTF_CloseFont(f.font);
+    gFonts.clear();
+    gFontIds.clear();
     SDL_DestroyRenderer(gRenderer);
     SDL_DestroyWindow(gWindow);
     IMG_Quit();
@@ -118,38 +338,290 @@ void cleanupSDL() {
 
 bool startsWith(const string& str, const string& prefix);
 
-void renderText(const string& text, int x, int y, const Style& style, int wrapWidth, int& outHeight) {
-    TTF_Font* font = TTF_OpenFont(style.ttf_path.c_str(), style.fontSize);
-    if (!font) {
-        cerr << "Font Error: " << TTF_GetError() << endl;
-        outHeight = style.fontSize;
-        return;
+// Break styled runs into line boxes at (x, y) and append the fragments to
+// `out`. Returns the height used. Nothing is rasterized here.
+int layoutRuns(const vector<TextRun>& runs, const vector<RunInfo>& runInfo, int x, int y, int maxWidth, DisplayList& out) {
+    vector<LineBox> boxes = breakLines(runs, maxWidth, gMeasurer);
+    for (const auto& box : boxes) {
+        for (const auto& frag : box.fragments) {
+            const TextRun& run = runs[frag.run];
+            const RunInfo& info = runInfo[run.style];
+            out.items.push_back({DisplayItem::Text, x + frag.x, y + box.y + frag.y, frag.width, gMeasurer.lineHeight(run.font),
+                                 run.text.substr(frag.begin, frag.end - frag.begin),
+                                 info.style, run.font});
+            if (info.element >= 0)
+                out.boxes.push_back({x + frag.x, y + box.y + frag.y, frag.width, gMeasurer.lineHeight(run.font), info.element});
+        }
     }
+    return boxes.empty() ? 0 : boxes.back().y + boxes.back().height;
+}
+
+// Painting functions take the origin of the target (a tile's position on the
+// page, or the scroll offset) and draw the item relative to it.
+void paintText(const DisplayItem& item, int originX, int originY) {
+    TTF_Font* font = fontHandle(item.font);
+    if (!font || item.text.empty()) return;
 
-    SDL_Surface* surface = TTF_RenderText_Blended_Wrapped(font, text.c_str(), style.colour, wrapWidth);
+    SDL_Surface* surface = TTF_RenderUTF8_Blended(font, item.text.c_str(), item.style.colour);
     if (!surface) {
         cerr << "Text Surface Error: " << TTF_GetError() << endl;
-        TTF_CloseFont(font);
-        outHeight = style.fontSize;
         return;
     }
 
     SDL_Texture* texture = SDL_CreateTextureFromSurface(gRenderer, surface);
-    SDL_Rect dst = { x, y, surface->w, surface->h };
+    SDL_Rect dst = { item.x - originX, item.y - originY, surface->w, surface->h };
     SDL_RenderCopy(gRenderer, texture, nullptr, &dst);
 
-    outHeight = surface->h;  // actual rendered height for cursor increment
-
     SDL_FreeSurface(surface);
     SDL_DestroyTexture(texture);
-    TTF_CloseFont(font);
+}
+
+void renderText(const string& text, int x, int y, const Style& style, int wrapWidth, int& outHeight) {
+    DisplayList list;
+    outHeight = layoutRuns({{collapseWhitespace(text), fontFor(style), 0}}, {{style, -1}}, x, y, wrapWidth, list);
+    if (outHeight == 0) outHeight = style.fontSize;
+    for (const auto& item : list.items) paintText(item, 0, 0);
 }
 
 string trim(const string& str);
 
-void renderImage(string& path, int x, int y) {
+// Blob kinds stored in the disk cache.
+enum : uint32_t { kBlobDocument = 1, kBlobImage = 2 };
+
+void premultiply(uint8_t* rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i, rgba += 4) {
+        unsigned a = rgba[3];
+        rgba[0] = Uint8((rgba[0] * a + 127) / 255);
+        rgba[1] = Uint8((rgba[1] * a + 127) / 255);
+        rgba[2] = Uint8((rgba[2] * a + 127) / 255);
+    }
+}
+
+void unpremultiply(uint8_t* rgba, size_t pixels) {
+    for (size_t i = 0; i < pixels; ++i, rgba += 4) {
+        unsigned a = rgba[3];
+        if (a == 0 || a == 255) continue;
+        rgba[0] = Uint8(min(255u, (rgba[0] * 255 + a / 2) / a));
+        rgba[1] = Uint8(min(255u, (rgba[1] * 255 + a / 2) / a));
+        rgba[2] = Uint8(min(255u, (rgba[2] * 255 + a / 2) / a));
+    }
+}
+
+SDL_BlendMode premultipliedBlend() {
+    static SDL_BlendMode mode = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+    return mode;
+}
+
+// Upload tightly packed premultiplied RGBA. Renderers without custom blend
+// modes (the software one) get a straight-alpha copy instead.
+SDL_Texture* uploadPremultiplied(const uint8_t* pixels, int w, int h) {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom((void*)pixels, w, h, 32, w * 4, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) return nullptr;
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(gRenderer, surface);
+    SDL_FreeSurface(surface);
+    if (!texture || SDL_SetTextureBlendMode(texture, premultipliedBlend()) == 0) return texture;
+
+    SDL_DestroyTexture(texture);
+    vector<uint8_t> straight(pixels, pixels + size_t(w) * h * 4);
+    unpremultiply(straight.data(), size_t(w) * h);
+    surface = SDL_CreateRGBSurfaceWithFormatFrom(straight.data(), w, h, 32, w * 4, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) return nullptr;
+    texture = SDL_CreateTextureFromSurface(gRenderer, surface);
+    SDL_FreeSurface(surface);
+    if (texture) SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    return texture;
+}
+
+bool cachedImageBlob(const string& path, MappedBlob& blob) {
+    return diskCache().lookup(path, kBlobImage, blob) &&
+           blob.payloadSize() == size_t(blob.header().width) * blob.header().height * 4;
+}
+
+// Decode `path` (a file or an http:// URL) to premultiplied RGBA and store
+// it in the disk cache. Runs on the loader's workers. `fetched` gets the size
+// of the encoded image.
+bool decodeImage(const string& path, vector<uint8_t>& pixels, int& w, int& h, size_t& fetched) {
+    cout << "Loading " + path + "\n";
+    string bytes, error;
+    if (!fetchResource(path, bytes, error)) {
+        cout << path + " Image Load Error: " + error + "\n";
+        return false;
+    }
+    fetched = bytes.size();
+    SDL_Surface* loaded = IMG_Load_RW(SDL_RWFromConstMem(bytes.data(), int(bytes.size())), 1);
+    SDL_Surface* rgba = loaded ? SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0) : nullptr;
+    if (loaded) SDL_FreeSurface(loaded);
+    if (!rgba) {
+        cout << path + " Image Load Error: " + IMG_GetError() + "\n";
+        return false;
+    }
+    w = rgba->w;
+    h = rgba->h;
+    pixels.resize(size_t(w) * h * 4);
+    SDL_LockSurface(rgba);
+    for (int row = 0; row < h; ++row)
+        memcpy(&pixels[size_t(row) * w * 4], (uint8_t*)rgba->pixels + size_t(row) * rgba->pitch, size_t(w) * 4);
+    SDL_UnlockSurface(rgba);
+    SDL_FreeSurface(rgba);
+
+    premultiply(pixels.data(), size_t(w) * h);
+    diskCache().store(path, kBlobImage, pixels.data(), pixels.size(), w, h);
+    return true;
+}
+
+// Premultiplied pixels of `path` at native size, from the disk cache or
+// decoded (and then cached). A cache hit is the mapped blob itself, kept
+// mapped while `img` is held. `fetched` gets the bytes read to decode it.
+bool imagePixels(const string& path, SharedPixels& img, size_t& fetched) {
+    auto blob = make_shared<MappedBlob>();
+    auto bytes = make_shared<vector<uint8_t>>();
+    fetched = 0;
+    if (cachedImageBlob(path, *blob)) {
+        img.w = int(blob->header().width);
+        img.h = int(blob->header().height);
+        img.data = shared_ptr<const uint32_t>(blob, reinterpret_cast<const uint32_t*>(blob->payload()));
+    } else if (decodeImage(path, *bytes, img.w, img.h, fetched)) {
+        img.data = shared_ptr<const uint32_t>(bytes, reinterpret_cast<const uint32_t*>(bytes->data()));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+string imageKey(const string& path, int width, int height) {
+    return width || height ? path + "@" + to_string(width) + "x" + to_string(height) : path;
+}
+
+// Layout size of a native w x h image asked for at width x height (0 = from
+// the image, keeping its aspect).
+void imageLayoutSize(int& width, int& height, int nativeW, int nativeH) {
+    if (!width && !height) {
+        width = nativeW;
+        height = nativeH;
+    } else if (!height) {
+        height = max(1, int(int64_t(width) * nativeH / nativeW));
+    } else if (!width) {
+        width = max(1, int(int64_t(height) * nativeW / nativeH));
+    }
+}
+
+// Loader hook for images, on a worker: decode, then shrink larger sources on
+// the CPU to the layout size so the GPU only holds what can be shown (smaller
+// ones are uploaded as they are and stretched), plus the mip levels.
+bool decodeImageResource(Resource& res) {
+    SharedPixels native;
+    if (!imagePixels(res.url, native, res.bytes)) {
+        res.error = "cannot decode " + res.url;
+        return false;
+    }
+    res.nativeW = native.w;
+    res.nativeH = native.h;
+    int width = res.width, height = res.height;
+    imageLayoutSize(width, height, native.w, native.h);
+    int baseW = min(width, native.w), baseH = min(height, native.h);
+    if (baseW == native.w && baseH == native.h) {
+        res.base = move(native);
+    } else {
+        auto resampled = make_shared<vector<uint32_t>>(size_t(baseW) * baseH);
+        if (!resampleBox(native.data.get(), native.w, native.h, resampled->data(), baseW, baseH)) {
+            res.error = "cannot resample " + res.url;
+            return false;
+        }
+        res.base = {shared_ptr<const uint32_t>(resampled, resampled->data()), baseW, baseH};
+    }
+    // The chain below the base; buildMipChain puts its argument first.
+    if (kImageMipLevels > 1 && min(baseW, baseH) / 2 >= kImageMinMipSide) {
+        ImagePixels half;
+        half.pixels.resize(size_t(baseW / 2) * (baseH / 2));
+        if (resampleBox(res.base.data.get(), baseW, baseH, half.pixels.data(), baseW / 2, baseH / 2)) {
+            half.w = baseW / 2;
+            half.h = baseH / 2;
+            res.levels = buildMipChain(move(half), kImageMipLevels - 1, kImageMinMipSide);
+        }
+    }
+    return true;
+}
+
+// Upload a finished image load under `key`. Its pixels are dropped after
+// (a drawImage source may still share the base): gImages keeps the
+// textures for the rest of the process.
+CachedImage& uploadImage(const string& key, Resource& res) {
+    CachedImage& img = gImages[key];
+    img = CachedImage();
+    img.path = res.url;
+    img.requestW = res.width;
+    img.requestH = res.height;
+    img.lastUsed = gFrame;
+    if (!res.ok) return img;   // no levels: not retried every frame
+    img.w = res.width;
+    img.h = res.height;
+    imageLayoutSize(img.w, img.h, res.nativeW, res.nativeH);
+    img.nativeBytes = size_t(res.nativeW) * res.nativeH * 4;
+    auto upload = [&img](const uint32_t* pixels, int w, int h) {
+        SDL_Texture* texture = uploadPremultiplied(reinterpret_cast<const uint8_t*>(pixels), w, h);
+        if (!texture) return false;
+        img.levels.push_back({texture, w, h});
+        img.textureBytes += size_t(w) * h * 4;
+        return true;
+    };
+    if (upload(res.base.data.get(), res.base.w, res.base.h))
+        for (auto& level : res.levels)
+            if (!upload(level.pixels.data(), level.w, level.h)) break;
+    res.base = SharedPixels();
+    res.levels.clear();
+    res.levels.shrink_to_fit();
+    return img;
+}
+
+void reloadImage(const string& key, CachedImage& img);
+
+// `path` laid out at width x height, or nullptr while the loader is still
+// fetching and decoding it (layout leaves a placeholder). Images the
+// prefetch scan missed are requested here. An evicted image keeps its size
+// until its refetch can be uploaded: its first load gave its pixels away.
+const CachedImage* loadImage(const string& path, int width = 0, int height = 0) {
+    string key = imageKey(path, width, height);
+    auto it = gImages.find(key);
+    if (it != gImages.end() && it->second.evicted) {
+        reloadImage(key, it->second);
+        Resource* res = gImageLoads[key];
+        return res->done() ? &uploadImage(key, *res) : &it->second;
+    }
+    if (it != gImages.end()) return &it->second;
+
+    Resource*& res = gImageLoads[key];
+    if (!res) res = &gLoader.request(ResourceKind::Image, path, 0, width, height);
+    if (!res->done()) return nullptr;
+    return &uploadImage(key, *res);
+}
+
+// Premultiplied pixels for canvas drawImage, decoded once per process. The
+// script waits for the loader first (ScriptHost::loadImage), so this shares
+// the loader's native-size base when it is still there.
+const uint32_t* canvasImagePixels(const string& path, int& w, int& h) {
+    auto& images = gCanvasSources;
+    auto it = images.find(path);
+    if (it == images.end()) {
+        SharedPixels img;
+        Resource* res = gLoader.find(ResourceKind::Image, path);
+        if (res && res->done() && res->base.data && res->base.w == res->nativeW && res->base.h == res->nativeH) {
+            img = res->base;
+        } else {
+            size_t fetched;
+            imagePixels(path, img, fetched);
+        }
+        it = images.emplace(path, move(img)).first;
+    }
+    w = it->second.w;
+    h = it->second.h;
+    return it->second.data.get();
+}
+
+// Trim an image path and undo Windows drive prefixes on Linux.
+void resolveImagePath(string& path) {
     path = trim(path);
-    cout << "Loading " << path << endl;
     if (os == "Linux") {
         if (startsWith(path, "C:") || startsWith(path, "c:")) {
             cout << "Warning: Attempting to load Windows-style path on Linux. Adjusting path.\n";
@@ -160,18 +632,242 @@ void renderImage(string& path, int x, int y) {
 
         }
     }
-    SDL_Surface* surface = IMG_Load(path.c_str());
-    if (!surface) {
-        cout << path << " Image Load Error: ";
-        cout << IMG_GetError() << endl;
+}
+
+// Draw the smallest level that still covers the item's w x h (images are
+// shown smaller than their layout size in narrow windows).
+void renderImage(const DisplayItem& item, int x, int y) {
+    auto it = gImages.find(item.text);
+    if (it == gImages.end()) return;
+    if (it->second.evicted) {
+        reloadImage(item.text, it->second);
         return;
     }
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(gRenderer, surface);
-    SDL_Rect dst = {x, y, surface->w, surface->h};
-    SDL_RenderCopy(gRenderer, texture, nullptr, &dst);
+    it->second.lastUsed = gFrame;
+    if (it->second.levels.empty()) return;
+    const vector<ImageLevel>& levels = it->second.levels;
+    size_t pick = 0;
+    while (pick + 1 < levels.size() && levels[pick + 1].w >= item.w && levels[pick + 1].h >= item.h) ++pick;
+    SDL_Rect dst = {x, y, item.w, item.h};
+    SDL_RenderCopy(gRenderer, levels[pick].texture, nullptr, &dst);
+}
 
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+// Upload the framebuffer only when a draw op changed it since last frame.
+void paintCanvas(const DisplayItem& item, int originX, int originY) {
+    auto it = gCanvases.find(item.text);
+    if (it == gCanvases.end()) return;
+    CanvasElement& el = it->second;
+    Canvas& canvas = el.canvas;
+
+    int texW = 0, texH = 0;
+    if (el.texture) SDL_QueryTexture(el.texture, nullptr, nullptr, &texW, &texH);
+    if (!el.texture || texW != canvas.width || texH != canvas.height) {
+        if (el.texture) SDL_DestroyTexture(el.texture);
+        el.texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, canvas.width, canvas.height);
+        if (!el.texture) {
+            cerr << "Canvas Texture Error: " << SDL_GetError() << endl;
+            return;
+        }
+        el.straightAlpha = SDL_SetTextureBlendMode(el.texture, premultipliedBlend()) != 0;
+        if (el.straightAlpha) SDL_SetTextureBlendMode(el.texture, SDL_BLENDMODE_BLEND);
+        canvas.dirty = true;
+    }
+
+    if (canvas.dirty) {
+        if (el.straightAlpha) {
+            vector<uint32_t> straight = canvas.pixels;
+            unpremultiply(reinterpret_cast<uint8_t*>(straight.data()), straight.size());
+            SDL_UpdateTexture(el.texture, nullptr, straight.data(), canvas.width * 4);
+        } else {
+            SDL_UpdateTexture(el.texture, nullptr, canvas.pixels.data(), canvas.width * 4);
+        }
+        canvas.dirty = false;
+    }
+
+    SDL_Rect dst = {item.x - originX, item.y - originY, canvas.width, canvas.height};
+    SDL_RenderCopy(gRenderer, el.texture, nullptr, &dst);
+}
+
+void paintItem(const DisplayItem& item, int originX, int originY) {
+    if (item.kind == DisplayItem::Text) {
+        paintText(item, originX, originY);
+    } else if (item.kind == DisplayItem::Canvas) {
+        paintCanvas(item, originX, originY);
+    } else {
+        renderImage(item, item.x - originX, item.y - originY);
+    }
+}
+
+// --- Compositor ---
+// Page content is rasterized once into kTileSize x kTileSize render-target
+// tiles; a frame copies the visible tiles and then the overlay layers (context
+// menu, dev console) on top. Scrolling, menus and typing only recomposite;
+// tiles are repainted after a layout, when a canvas under them changes, or
+// when they scroll into view without being cached. Tiles beyond the budget
+// are evicted least recently used first.
+const int kTileSize = 256;
+const size_t kTileBudgetBytes = size_t(64) << 20;   // default for ASTRA_MEM_TILES_MB
+const size_t kTileBytes = size_t(kTileSize) * kTileSize * 4;
+
+struct Tile {
+    SDL_Texture* texture = nullptr;
+    bool valid = false;
+    uint64_t lastUsed = 0;   // frame number
+};
+
+struct Compositor {
+    unordered_map<uint64_t, Tile> tiles;   // key: row << 32 | col
+    HitIndex items;                        // display item bounds; HitBox::element is the item index
+    bool useTiles = true;                  // false if the renderer has no render targets
+    int repainted = 0;                     // tiles rasterized in the last frame
+    size_t bytes() const { return tiles.size() * kTileBytes; }
+};
+
+Compositor gCompositor;
+int gScrollY = 0;
+
+// Offscreen texture for an overlay, redrawn only when marked dirty.
+struct Layer {
+    SDL_Texture* texture = nullptr;
+    int w = 0, h = 0;
+    bool dirty = true;
+};
+
+Layer gMenuLayer, gConsoleLayer;
+
+// Called after every layout: the tiles no longer match the display list.
+void indexDisplayList(const DisplayList& list) {
+    vector<HitBox> bounds;
+    bounds.reserve(list.items.size());
+    for (size_t i = 0; i < list.items.size(); ++i) {
+        const DisplayItem& item = list.items[i];
+        bounds.push_back({item.x, item.y, max(item.w, 1), max(item.h, 1), int(i)});
+    }
+    gCompositor.items.build(move(bounds));
+    for (auto& [key, tile] : gCompositor.tiles) tile.valid = false;
+}
+
+void invalidateTiles(int x, int y, int w, int h) {
+    for (int row = y / kTileSize; row <= (y + h - 1) / kTileSize; ++row)
+        for (int col = x / kTileSize; col <= (x + w - 1) / kTileSize; ++col) {
+            auto it = gCompositor.tiles.find((uint64_t(row) << 32) | uint32_t(col));
+            if (it != gCompositor.tiles.end()) it->second.valid = false;
+        }
+}
+
+// Items are picked with a small margin so glyph overhang (italics) that
+// crosses a tile edge is painted on both sides.
+void paintRegion(const DisplayList& list, int x, int y, int w, int h) {
+    const int margin = 8;
+    static vector<int> hits;
+    gCompositor.items.queryRect(x - margin, y - margin, w + 2 * margin, h + 2 * margin, hits);
+    sort(hits.begin(), hits.end(), [](int a, int b) {
+        return gCompositor.items.boxes()[a].element < gCompositor.items.boxes()[b].element;   // paint order
+    });
+    for (int i : hits) paintItem(list.items[gCompositor.items.boxes()[i].element], x, y);
+}
+
+bool paintTile(const DisplayList& list, Tile& tile, int col, int row) {
+    if (!tile.texture) {
+        tile.texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, kTileSize, kTileSize);
+        if (!tile.texture) return false;
+    }
+    SDL_SetRenderTarget(gRenderer, tile.texture);
+    SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255);
+    SDL_RenderClear(gRenderer);
+    paintRegion(list, col * kTileSize, row * kTileSize, kTileSize, kTileSize);
+    SDL_SetRenderTarget(gRenderer, nullptr);
+    tile.valid = true;
+    ++gCompositor.repainted;
+    return true;
+}
+
+void releaseTiles() {
+    for (auto& [key, tile] : gCompositor.tiles) if (tile.texture) SDL_DestroyTexture(tile.texture);
+    gCompositor.tiles.clear();
+    for (Layer* layer : {&gMenuLayer, &gConsoleLayer}) {
+        if (layer->texture) SDL_DestroyTexture(layer->texture);
+        *layer = Layer();
+    }
+}
+
+// Draw the visible part of the page at the current scroll offset.
+void compositePage(const DisplayList& list) {
+    ++gFrame;
+    gCompositor.repainted = 0;
+
+    // Canvases changed by script since the last frame repaint their tiles.
+    for (const auto& item : list.items)
+        if (item.kind == DisplayItem::Canvas) {
+            auto it = gCanvases.find(item.text);
+            if (it != gCanvases.end() && it->second.canvas.dirty) invalidateTiles(item.x, item.y, item.w, item.h);
+        }
+
+    if (!gCompositor.useTiles) {
+        paintRegion(list, 0, gScrollY, gWindowWidth, gWindowHeight);
+        return;
+    }
+
+    for (int row = gScrollY / kTileSize; row * kTileSize < gScrollY + gWindowHeight; ++row) {
+        for (int col = 0; col * kTileSize < gWindowWidth; ++col) {
+            Tile& tile = gCompositor.tiles[(uint64_t(row) << 32) | uint32_t(col)];
+            tile.lastUsed = gFrame;
+            if (!tile.valid && !paintTile(list, tile, col, row)) {
+                cerr << "Tile Error: " << SDL_GetError() << ", painting directly" << endl;
+                gCompositor.useTiles = false;
+                releaseTiles();
+                paintRegion(list, 0, gScrollY, gWindowWidth, gWindowHeight);
+                return;
+            }
+            SDL_Rect dst = {col * kTileSize, row * kTileSize - gScrollY, kTileSize, kTileSize};
+            SDL_RenderCopy(gRenderer, tile.texture, nullptr, &dst);
+        }
+    }
+    // Images on screen count as used even when their tiles did not repaint.
+    static vector<int> visible;
+    gCompositor.items.queryRect(0, gScrollY, gWindowWidth, gWindowHeight, visible);
+    for (int i : visible) {
+        const DisplayItem& item = list.items[gCompositor.items.boxes()[i].element];
+        if (item.kind != DisplayItem::Image) continue;
+        auto it = gImages.find(item.text);
+        if (it != gImages.end()) it->second.lastUsed = gFrame;
+    }
+}
+
+// Composite an overlay at (x, y), redrawing its texture first if needed.
+// `draw` paints the overlay with its top-left corner at the given origin.
+void compositeLayer(Layer& layer, int x, int y, int w, int h, const function<void(int, int)>& draw) {
+    if (!gCompositor.useTiles) {
+        draw(x, y);
+        return;
+    }
+    if (!layer.texture || layer.w != w || layer.h != h) {
+        if (layer.texture) SDL_DestroyTexture(layer.texture);
+        layer.texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+        if (!layer.texture) {
+            draw(x, y);
+            return;
+        }
+        SDL_SetTextureBlendMode(layer.texture, SDL_BLENDMODE_BLEND);
+        layer.w = w;
+        layer.h = h;
+        layer.dirty = true;
+    }
+    if (layer.dirty) {
+        SDL_SetRenderTarget(gRenderer, layer.texture);
+        SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 0);
+        SDL_RenderClear(gRenderer);
+        draw(0, 0);
+        SDL_SetRenderTarget(gRenderer, nullptr);
+        layer.dirty = false;
+    }
+    SDL_Rect dst = {x, y, w, h};
+    SDL_RenderCopy(gRenderer, layer.texture, nullptr, &dst);
+}
+
+void scrollBy(int dy) {
+    int maxScroll = max(0, gDisplayList.height - gWindowHeight);
+    gScrollY = clamp(gScrollY + dy, 0, maxScroll);
 }
 
 vector<string> used_alert_messages;
@@ -182,6 +878,10 @@ void js_alert(const std::string& message, const std::string& documentTitle) {
     if (find(used_alert_messages.begin(), used_alert_messages.end(), message) != used_alert_messages.end())
         return; // already shown
     used_alert_messages.push_back(message);
+    if (gHeadless) {
+        cout << "alert: " << message << endl;
+        return;
+    }
     std::string title = documentTitle.empty() ? "Untitled Page" : documentTitle;
 
     SDL_ShowSimpleMessageBox(
@@ -224,7 +924,7 @@ unordered_map<string, Style> parseStyles(const vector<string>& lines) {
         else if (inStyles && line == ".style start") {
             inStyleBlock = true;
             currentTarget.clear();
-            currentStyle = {{0,0,0,255}, 24, "Arial.ttf"};
+            currentStyle = {{0,0,0,255}, 24, kDefaultFace};
         }
         else if (inStyles && line == ".style end") {
             if (!currentTarget.empty()) {
@@ -236,17 +936,15 @@ unordered_map<string, Style> parseStyles(const vector<string>& lines) {
             currentTarget = line.substr(10);
         }
         else if (inStyleBlock && line.rfind("colour ", 0) == 0) {
-            string hex = line.substr(7);
-            int r = stoi(hex.substr(1, 2), nullptr, 16);
-            int g = stoi(hex.substr(3, 2), nullptr, 16);
-            int b = stoi(hex.substr(5, 2), nullptr, 16);
-            currentStyle.colour = {Uint8(r), Uint8(g), Uint8(b), 255};
+            Rgba c;
+            if (parseColour(string_view(line).substr(7), c)) currentStyle.colour = {c.r, c.g, c.b, c.a};
+            else cerr << "Unsupported colour for " << currentTarget << ": " << line.substr(7) << endl;
         }
         else if (inStyleBlock && line.rfind("fontSize ", 0) == 0) {
-            currentStyle.fontSize = stoi(line.substr(9));
+            currentStyle.fontSize = uint16_t(clamp(atoi(line.c_str() + 9), 1, 1000));
         }
         else if (inStyleBlock && line.rfind("ttf ", 0) == 0) {
-            currentStyle.ttf_path = line.substr(4);
+            currentStyle.face = internFontFace(line.substr(4));
         }
     }
 
@@ -271,9 +969,283 @@ vector<string> split(const string& str, char delimiter) {
     return result;
 }
 
-string promptConsole(const string& message);
+// --- Document loading ---
+// The compiled form of an .ab is its lines plus the parsed style table; a
+// warm start maps it from the disk cache instead of re-reading and parsing.
+string serializeDocument(const vector<string>& lines, const unordered_map<string, Style>& styles) {
+    BlobWriter out;
+    out.u32(uint32_t(lines.size()));
+    for (const auto& line : lines) out.str(line);
+    out.u32(uint32_t(styles.size()));
+    for (const auto& [id, style] : styles) {
+        out.str(id);
+        out.raw(&style.colour, sizeof(style.colour));
+        out.u32(uint32_t(style.fontSize));
+        out.u32(uint32_t(style.fontStyle));
+        out.str(gFontFaces[style.face]);
+    }
+    return out.bytes;
+}
+
+bool deserializeDocument(const MappedBlob& blob, vector<string>& lines, unordered_map<string, Style>& styles) {
+    BlobReader in = {blob.payload(), blob.payload() + blob.payloadSize()};
+    uint32_t lineCount = in.u32();
+    for (uint32_t i = 0; i < lineCount && in.ok; ++i) lines.push_back(in.str());
+    uint32_t styleCount = in.u32();
+    for (uint32_t i = 0; i < styleCount && in.ok; ++i) {
+        string id = in.str();
+        Style style;
+        in.take(&style.colour, sizeof(style.colour));
+        style.fontSize = uint16_t(in.u32());
+        style.fontStyle = uint8_t(in.u32());
+        style.face = internFontFace(in.str());
+        styles[id] = style;
+    }
+    return in.ok;
+}
+
+bool loadDocument(const string& path) {
+    vector<string> lines;
+    unordered_map<string, Style> styles;
+
+    MappedBlob blob;
+    if (!diskCache().lookup(path, kBlobDocument, blob) || !deserializeDocument(blob, lines, styles)) {
+        lines.clear();
+        styles.clear();
+        ifstream file(path);
+        if (!file.is_open()) {
+            cerr << "Failed to open file: " << path << endl;
+            return false;
+        }
+        string line;
+        while (getline(file, line)) lines.push_back(line);
+        styles = parseStyles(lines);
+
+        string compiled = serializeDocument(lines, styles);
+        diskCache().store(path, kBlobDocument, compiled.data(), compiled.size());
+    }
+
+    gLines = move(lines);
+    gStyles = move(styles);
+    return true;
+}
+
 void logToConsole(const string& msg);
+extern ScriptLoop gScripts;
+
+string_view trimView(string_view s) {
+    while (!s.empty() && isspace((unsigned char)s.front())) s.remove_prefix(1);
+    while (!s.empty() && isspace((unsigned char)s.back())) s.remove_suffix(1);
+    return s;
+}
+
+// --- Resource loading ---
+// Every external resource of a page is requested as soon as the .ab is
+// loaded; workers fetch and decode them while the main thread lays out and
+// paints with placeholders. Each frame picks up what finished.
+
+// When the page's load started and finished, on the loader's clock. The
+// first meaningful frame is the first one showing every image that is in
+// the viewport.
+struct PageLoad {
+    double meaningfulMs = -1;
+    double loadedMs = -1;
+} gPageLoad;
+
+// Main-thread callbacks waiting for a resource to finish.
+vector<pair<Resource*, function<void()>>> gResourceWaiters;
+
+// Images laid out before they loaded, with whether the placeholder already
+// had their final size (then only its tiles repaint when they arrive).
+unordered_map<string, bool> gImagePlaceholders;
+
+// A resource a script is waiting for: requested if nothing asked for it yet,
+// and moved to the front of the queue.
+Resource& scriptResource(ResourceKind kind, const string& url) {
+    Resource* res = gLoader.find(kind, url);
+    if (!res) return gLoader.request(kind, url, -1);
+    gLoader.reprioritize(*res, -1);
+    return *res;
+}
+
+void whenLoaded(Resource& res, function<void()> callback) {
+    if (res.done()) callback();
+    else gResourceWaiters.push_back({&res, move(callback)});
+}
+
+// Inline timer callbacks of each external script get their own prefix, so
+// they do not collide with the page's or another script's.
+string scriptCallbackPrefix(const string& url) {
+    string prefix;
+    for (char c : url) prefix += isalnum((unsigned char)c) ? c : '_';
+    return prefix + "_callback";
+}
+
+void initLoader() {
+    gLoader.setHook(ResourceKind::Image, decodeImageResource);
+    // External scripts are translated like conv translates inline ones.
+    gLoader.setHook(ResourceKind::Script, [](Resource& res) {
+        string js;
+        if (!fetchResource(res.url, js, res.error)) return false;
+        res.bytes = js.size();
+        ostringstream ab;
+        ostream discard(nullptr);
+        JsTranslator(scriptCallbackPrefix(res.url)).translate(js, ab, discard);
+        res.text = ab.str();
+        return true;
+    });
+}
+
+// Request everything `lines` refers to. Scripts and stylesheets go first;
+// images start in document order until layout knows where they are.
+void prefetchResources(const vector<string>& lines) {
+    string src;
+    int width = 0, height = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        string_view view = trimView(lines[i]);
+        size_t space = view.find(' ');
+        const AbCommand* cmd = abCommand(view.substr(0, space));
+        if (!cmd) continue;
+        string arg = space == string_view::npos ? "" : string(trimView(view.substr(space + 1)));
+        switch (cmd->id) {
+        case Ab::Img:
+            if (arg == "start") {
+                src.clear();
+                width = height = 0;
+            } else if (arg == "end" && !src.empty()) {
+                resolveImagePath(src);
+                gImageLoads[imageKey(src, width, height)] = &gLoader.request(ResourceKind::Image, src, double(i), width, height);
+            }
+            break;
+        case Ab::Media:
+            src = arg;
+            break;
+        case Ab::Size:
+            sscanf(arg.c_str(), "%d %d", &width, &height);
+            break;
+        case Ab::Script:
+            if (startsWith(arg, "src ")) {
+                string path = arg.substr(4);
+                resolveImagePath(path);
+                gLoader.request(ResourceKind::Script, path, -1);
+            }
+            break;
+        case Ab::Stylesheet:
+            gLoader.request(ResourceKind::Stylesheet, arg, -1);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// A new page (or a reload): drop the old page's loads and request this one's.
+void startPageLoad(const vector<string>& lines) {
+    gResourceWaiters.clear();
+    gImageLoads.clear();
+    gImagePlaceholders.clear();
+    gLoader.clear();
+    gPageLoad = {};
+    prefetchResources(lines);
+}
+
+void invalidateTiles(int x, int y, int w, int h);
+
+// Fetch an evicted image again; painted from a same-size placeholder until
+// it is back, like one that has not loaded yet.
+void reloadImage(const string& key, CachedImage& img) {
+    if (img.reloading) return;
+    img.reloading = true;
+    Resource& res = gLoader.request(ResourceKind::Image, img.path, 0, img.requestW, img.requestH);
+    if (res.done()) gLoader.refetch(res, 0);   // its levels went to the evicted textures
+    gImageLoads[key] = &res;
+    gImagePlaceholders[key] = true;
+}
+
+// Take what the loader finished since the last frame: images replace their
+// placeholders, waiting scripts resume.
+void collectResources() {
+    vector<Resource*> finished = gLoader.drainCompleted();
+    if (finished.empty()) return;
+    for (Resource* res : finished) {
+        if (!res->ok) {
+            cout << "Failed to load " << resourceKindName(res->kind) << " " << res->url << ": " << res->error << endl;
+        } else if (res->kind == ResourceKind::Stylesheet) {
+            cout << "Stylesheet " << res->url << ": " << res->text.size() << " bytes (external CSS is not applied yet)\n";
+        }
+        if (res->kind != ResourceKind::Image) continue;
+
+        string key = imageKey(res->url, res->width, res->height);
+        auto placeholder = gImagePlaceholders.find(key);
+        if (placeholder == gImagePlaceholders.end()) continue;   // not laid out yet
+        if (placeholder->second && !gNeedsLayout) {
+            auto old = gImages.find(key);
+            bool reloaded = old != gImages.end() && old->second.evicted;
+            const CachedImage& img = *loadImage(res->url, res->width, res->height);
+            if (!img.levels.empty() && !reloaded) {
+                gPageImages.images += 1;
+                gPageImages.nativeBytes += img.nativeBytes;
+                gPageImages.textureBytes += img.textureBytes;
+            }
+            for (const auto& item : gDisplayList.items)
+                if (item.kind == DisplayItem::Image && item.text == key) invalidateTiles(item.x, item.y, item.w, item.h);
+        } else {
+            gNeedsLayout = true;   // its size was a guess
+        }
+        gImagePlaceholders.erase(placeholder);
+    }
 
+    for (size_t i = 0; i < gResourceWaiters.size();) {
+        if (!gResourceWaiters[i].first->done()) {
+            ++i;
+            continue;
+        }
+        auto callback = move(gResourceWaiters[i].second);
+        gResourceWaiters.erase(gResourceWaiters.begin() + i);
+        callback();
+    }
+}
+
+// Queue images still loading by their distance from the viewport, so what is
+// on screen arrives first. Returns how many of them are on screen.
+int prioritizeImages(const DisplayList& list) {
+    int onScreen = 0;
+    for (const auto& item : list.items) {
+        if (item.kind != DisplayItem::Image || gImages.count(item.text)) continue;
+        auto it = gImageLoads.find(item.text);
+        if (it == gImageLoads.end() || it->second->done()) continue;
+        int distance = max({0, item.y - (gScrollY + gWindowHeight), gScrollY - (item.y + item.h)});
+        if (distance == 0) ++onScreen;
+        gLoader.reprioritize(*it->second, distance);
+    }
+    return onScreen;
+}
+
+// Print the page's load times once: the first meaningful frame, then when
+// the last resource came in.
+void reportPageLoad(int imagesLoadingOnScreen) {
+    if (gPageLoad.meaningfulMs < 0 && imagesLoadingOnScreen == 0) {
+        gPageLoad.meaningfulMs = gLoader.now();
+        cout << "First meaningful frame after " << gPageLoad.meaningfulMs << " ms\n";
+    }
+    if (gPageLoad.loadedMs < 0 && !gLoader.busy() && gResourceWaiters.empty()) {
+        gPageLoad.loadedMs = gLoader.now();
+        ResourceLoader::Stats stats = gLoader.stats();
+        cout << "Resources: " << stats.done << " loaded (" << stats.failed << " failed, " << stats.deduped
+             << " duplicate requests) on " << gLoader.threads() << " threads, " << (stats.bytes >> 10)
+             << " KB fetched, all in after " << gPageLoad.loadedMs << " ms\n";
+        if (gPageImages.images) {
+            cout << "Images: " << gPageImages.images << " using " << (gPageImages.textureBytes >> 10) << " KB of textures, "
+                 << (gPageImages.nativeBytes >> 10) << " KB at native size ("
+                 << (int64_t(gPageImages.nativeBytes) - int64_t(gPageImages.textureBytes)) / 1024 << " KB saved)\n";
+        }
+        gMemory.measure();
+        cout << "Memory: " << gMemory.summary() << "\n";
+    }
+}
+
+// Lays the document out into gDisplayList and runs its script. Nothing is
+// drawn here; see paintDisplayList.
 void exec(const vector<string>& lines, const unordered_map<string, Style>& styles, int windowWidth, bool first_time) {
     State state;
     int baseX = 50;
@@ -282,130 +1254,208 @@ void exec(const vector<string>& lines, const unordered_map<string, Style>& style
     int lineSpacing = 5;
     vector<int> indentStack;
     string pendingImgSrc, pendingImgDesc;
+    int pendingWidth = 0, pendingHeight = 0;   // from ".size" (canvas pixels, image layout size)
     string currentID;
-    map<string, string> variables;
+    vector<string> inlineIDs;
+    vector<string> script;   // kAbScript lines, handed to gScripts on (re)load
     int pc = 0;
 
-    for (const auto& line : lines) {
-        pc += 1;
-        // --- State handling ---
-        if (line == ".Doc start") state.push("Doc");
-        else if (line == ".Doc end") state.pop();
-        else if (line == ".html start") state.push("html");
-        else if (line == ".html end") state.pop();
-        else if (line == ".body start") state.push("body");
-        else if (line == ".body end") state.pop();
-
-        else if (startsWith(line, "genFrom ")) SrcName = line.substr(8);
-
-        else if (line == ".title start") state.push("title");
-        else if (line == ".title end") state.pop();
+    DisplayList& list = gDisplayList;
+    list = DisplayList();
+    gElementHandlers.clear();
+    if (first_time) {
+        // A reload redraws every canvas from its ops.
+        for (auto& [id, el] : gCanvases) if (el.texture) SDL_DestroyTexture(el.texture);
+        gCanvases.clear();
+    }
+    gPageImages = {};
+    unordered_map<string, int> elementIndex;
+    auto elementFor = [&](const string& id) {
+        auto it = elementIndex.find(id);
+        if (it != elementIndex.end()) return it->second;
+        list.elements.push_back(id);
+        return elementIndex[id] = int(list.elements.size()) - 1;
+    };
 
-        else if (line == ".header start") state.push("header");
-        else if (line == ".header end") state.pop();
+    vector<TextRun> runs;
+    vector<RunInfo> runInfo;
+    int runX = baseX;
+    string blockID;
+
+    auto flushInline = [&]() {
+        if (runs.empty()) return;
+        int maxWidth = windowWidth - runX - baseX;
+        int height = layoutRuns(runs, runInfo, runX, cursorY, maxWidth, list);
+        if (!blockID.empty()) list.boxes.push_back({runX, cursorY, maxWidth, height, elementFor(blockID)});
+        cursorY += height + lineSpacing;
+        runs.clear();
+        runInfo.clear();
+    };
 
-        else if (line == ".para start") state.push("para");
-        else if (line == ".para end") { state.pop(); cursorY += lineSpacing; }
+    auto layoutImage = [&]() {
+        if (!pendingImgSrc.empty()) {
+            resolveImagePath(pendingImgSrc);
+            string key = imageKey(pendingImgSrc, pendingWidth, pendingHeight);
+            const CachedImage* img = loadImage(pendingImgSrc, pendingWidth, pendingHeight);
+            bool loaded = img && !img->levels.empty();
+            bool reloading = img && img->evicted;   // keeps its box until it is back
+            if (loaded || reloading) {
+                gPageImages.images += 1;
+                gPageImages.nativeBytes += img->nativeBytes;
+                gPageImages.textureBytes += img->textureBytes;
+            }
+            // Still loading: hold the space if .size gave it, else guess.
+            int w = img ? img->w : pendingWidth, h = img ? img->h : pendingHeight;
+            if (!img) {
+                bool sized = pendingWidth && pendingHeight;
+                gImagePlaceholders[key] = sized;
+                if (!sized) w = h = 0;
+            }
+            // Shrink (keeping the aspect) to fit the window, like max-width: 100%.
+            int maxWidth = windowWidth - cursorX - baseX;
+            if (w > maxWidth && maxWidth > 0) {
+                h = max(1, int(int64_t(h) * maxWidth / w));
+                w = maxWidth;
+            }
+            // A sized placeholder already has its final box, so it is
+            // clickable before the image arrives (which only repaints tiles).
+            bool placed = loaded || reloading || (!img && h);
+            list.items.push_back({DisplayItem::Image, cursorX, cursorY, w, h, key, {}, -1});
+            if (!currentID.empty() && placed)
+                list.boxes.push_back({cursorX, cursorY, w, h, elementFor(currentID)});
+            cursorY += placed ? h + lineSpacing : 200;
+        }
+        if (!pendingImgDesc.empty()) {
+            Style style = {{0,0,0,255}, 18, kDefaultFace};
+            if (!currentID.empty() && styles.count(currentID)) style = styles.at(currentID);
+            int textHeight = layoutRuns({{collapseWhitespace(pendingImgDesc), fontFor(style), 0}}, {{style, -1}},
+                                        cursorX, cursorY, windowWidth - cursorX - baseX, list);
+            cursorY += textHeight + lineSpacing;
+            cursorY += style.fontSize + lineSpacing;
+        }
+    };
 
-        else if (line == ".h2 start") state.push("h2");
-        else if (line == ".h2 end") { state.pop(); cursorY += lineSpacing; }
+    auto layoutCanvas = [&]() {
+        if (currentID.empty()) return;
+        CanvasElement& el = gCanvases[currentID];
+        if (el.canvas.width != pendingWidth || el.canvas.height != pendingHeight)
+            el.canvas.resize(pendingWidth, pendingHeight);
+        list.items.push_back({DisplayItem::Canvas, cursorX, cursorY, el.canvas.width, el.canvas.height, currentID, {}, -1});
+        list.boxes.push_back({cursorX, cursorY, el.canvas.width, el.canvas.height, elementFor(currentID)});
+        cursorY += el.canvas.height + lineSpacing;
+    };
 
-        else if (line == ".ul start") { state.push("ul"); indentStack.push_back(20); }
-        else if (line == ".ul end") { state.pop(); indentStack.pop_back(); }
+    for (const auto& line : lines) {
+        pc += 1;
 
-        else if (line == ".li start") state.push("li");
-        else if (line == ".li end") { state.pop(); cursorY += lineSpacing; }
+        // The first token picks the registry row: ".para start" -> .para,
+        // "log hi" -> log. Text and inline tags keep the current run open;
+        // anything else (including unknown lines) ends it.
+        string_view view = trimView(line);
+        size_t space = view.find(' ');
+        const AbCommand* cmd = abCommand(view.substr(0, space));
+        string arg = space == string_view::npos ? "" : string(trimView(view.substr(space + 1)));
+        if (!cmd || !(cmd->flags & kAbInline)) flushInline();
+        if (!cmd) continue;
+        if (cmd->flags & kAbScript) {
+            if (first_time) script.push_back(line);
+            continue;
+        }
+        if (cmd->id == Ab::Script && startsWith(arg, "src ")) {   // run in place by the script loop
+            if (first_time) script.push_back(line);
+            continue;
+        }
 
-        else if (line == ".script start") state.push("script");
-        else if (line == ".script end") { state.pop(); cursorY += lineSpacing; }
+        // --- State handling ---
+        if (cmd->flags & kAbElement) {
+            if (arg == "start") {
+                state.push(cmd->id);
+                if (cmd->indent) indentStack.push_back(cmd->indent);
+                if (cmd->flags & kAbInline) inlineIDs.push_back(currentID);
+                if (cmd->id == Ab::Img) { pendingImgSrc.clear(); pendingImgDesc.clear(); pendingWidth = pendingHeight = 0; }
+                if (cmd->id == Ab::Canvas) { pendingWidth = 300; pendingHeight = 150; }
+            } else if (arg == "end") {
+                if (cmd->id == Ab::Img) layoutImage();
+                if (cmd->id == Ab::Canvas) layoutCanvas();
+                state.pop();
+                if (cmd->indent && !indentStack.empty()) indentStack.pop_back();
+                if ((cmd->flags & kAbInline) && !inlineIDs.empty()) { currentID = inlineIDs.back(); inlineIDs.pop_back(); }
+                if (cmd->flags & kAbSpaced) cursorY += lineSpacing;
+            }
+            continue;
+        }
 
-        else if (line == ".strong start") state.push("strong");
-        else if (line == ".strong end") state.pop();
+        switch (cmd->id) {
+        case Ab::GenFrom:
+            SrcName = arg;
+            break;
 
-        else if (line.rfind("ID: ", 0) == 0) currentID = line.substr(4);
+        case Ab::Id:
+            currentID = arg;
+            break;
 
-        // --- Text rendering ---
-        else if (line.rfind(".txt ", 0) == 0) {
-            string text = line.substr(5);
-            Style style = {{0,0,0,255}, 24, "Arial.ttf"};
+        // --- Text runs ---
+        case Ab::Txt: {
+            string text = arg;
+            Style style = {{0,0,0,255}, 24, kDefaultFace};
             if (!currentID.empty() && styles.count(currentID)) style = styles.at(currentID);
 
-            string curState = state.current();
-            if (curState == "header") style.fontSize += 8;
-            else if (curState == "h2") style.fontSize += 6;
+            // Innermost element with a size change wins; font styles add up.
+            int sizeDelta = 0;
+            for (auto it = state.tags().rbegin(); it != state.tags().rend(); ++it) {
+                const AbCommand& el = kAbCommands[size_t(*it)];
+                if (!sizeDelta) sizeDelta = el.fontSizeDelta;
+                style.fontStyle |= el.fontStyle;
+            }
+            style.fontSize = uint16_t(style.fontSize + sizeDelta);
 
-            if (state.current() == "title") {
+            if (state.currentIs(Ab::Title)) {
                 SDL_SetWindowTitle(gWindow, text.c_str());
             } else {
-                int x = baseX + (indentStack.empty() ? 0 : indentStack.back());
-                if (state.current() == "li") text = "- " + text;
-
-                int textHeight = 0;
-                renderText(text, x, cursorY, style, windowWidth - x - baseX, textHeight);
-                cursorY += textHeight + lineSpacing;  // increment by actual rendered height
+                if (runs.empty()) {
+                    runX = baseX + (indentStack.empty() ? 0 : indentStack.back());
+                    blockID = inlineIDs.empty() ? currentID : inlineIDs.front();
+                    if (state.has(Ab::Li)) text = "- " + text;
+                }
+                int element = currentID.empty() ? -1 : elementFor(currentID);
+                runs.push_back({collapseWhitespace(text), fontFor(style), int(runInfo.size())});
+                runInfo.push_back({style, element});
             }
+            break;
         }
 
-
         // --- Image handling ---
-        else if ((line == ".img start") || (trim(line) == ".img start")) { state.push("img"); pendingImgSrc.clear(); pendingImgDesc.clear(); }
-        else if ((line == ".img end") || (trim(line) == ".img end")) {
-            if (!pendingImgSrc.empty()) { renderImage(pendingImgSrc, cursorX, cursorY); cursorY += 200; }
-            if (!pendingImgDesc.empty()) {
-                Style style = {{0,0,0,255}, 18, "Arial.ttf"};
-                if (!currentID.empty() && styles.count(currentID)) style = styles.at(currentID);
-                int textHeight = 0;
-                renderText(pendingImgDesc, cursorX, cursorY, style, windowWidth - cursorX - baseX, textHeight);
-                cursorY += textHeight + lineSpacing;  // increment by actual rendered height
-                cursorY += style.fontSize + lineSpacing;
-            }
-            state.pop();
-        } else if (startsWith(line, "log")) {
-            string logContentRAW = line.substr(4);
-            string logContent;
-            for (string str : split(logContentRAW, ' ')) {
-                if (startsWith(str, "\\$")) {
-                    string var = str.substr(2);
-                    if (variables.count(var)) logContent += variables[var];
-                } else {
-                    logContent += str + " ";
-                }
-            }
-            if (first_time) {
-                logToConsole("[" + SrcName + "]: " + logContent + "\n");
-            }
+        case Ab::Media:
+            pendingImgSrc = arg;
+            break;
+
+        case Ab::Desc:
+            pendingImgDesc = arg;
+            break;
+
+        case Ab::Size:
+            sscanf(arg.c_str(), "%d %d", &pendingWidth, &pendingHeight);
+            break;
+
+        // ".on <event> <action>" attaches a handler to the current element.
+        case Ab::On: {
+            size_t spacePos = arg.find(' ');
+            if (!currentID.empty() && spacePos != string::npos)
+                gElementHandlers[currentID].push_back({arg.substr(0, spacePos), trim(arg.substr(spacePos + 1))});
+            break;
         }
-        else if (startsWith(line, "alert")) {
-            string alertContent = line.substr(6);
-            if (first_time) {
-                js_alert(alertContent, SDL_GetWindowTitle(gWindow));
-            }
-        }
-        else if (startsWith(line, "let ")) {
-            string rest = line.substr(4);
-            size_t eqPos = rest.find('=');
-            if (eqPos != string::npos) {
-                string varName = trim(rest.substr(0, eqPos));
-                string varValue = trim(rest.substr(eqPos + 1));
-                variables[varName] = varValue;
-            }
-        }
-        else if (startsWith(line, "prompt ") && first_time) {
-            string rest = line.substr(7);
-            size_t spacePos = rest.find(' ');
-            if (spacePos != string::npos) {
-                string varName = trim(rest.substr(0, spacePos));
-                string promptMsg = trim(rest.substr(spacePos + 1));
-                
-                string val = promptConsole(promptMsg);
-                variables[varName] = val;
-            }
-        }
-        else if (line.rfind(".media ", 0) == 0) pendingImgSrc = line.substr(7);
 
-        
-        else if (line.rfind(".desc ", 0) == 0) pendingImgDesc = line.substr(6);
+        default:
+            break;
+        }
     }
+    flushInline();
+    list.height = cursorY;
+    gHitIndex.build(list.boxes);
+
+    // Scripts start once the canvases they draw into are laid out; they run
+    // from the main loop, a slice per frame.
+    if (first_time) gScripts.start(move(script));
 }
 
 struct Console {
@@ -433,37 +1483,32 @@ void showContextMenu(int mouseX, int mouseY) {
     }
 
     contextMenu.visible = true;
+    gMenuLayer.dirty = true;
     contextMenu.items = {
         {"Dev Tools", [](){ devConsole.active = true; }},
         {"Refresh", [](){
-            vector<string> lines;
-            ifstream file(infile);
-            if (!file.is_open()) {
-                cerr << "Failed to open file: " << infile << endl;
-                return;
-            }
-            string line;
-            while (getline(file, line)) lines.push_back(line);
-            auto styles = parseStyles(lines);
-            SDL_RenderClear(gRenderer);
-            exec(lines, styles, gWindowWidth, true); // force re-exec
+            if (!loadDocument(infile)) return;
+            startPageLoad(gLines);
+            gRunScripts = true; // force re-exec
+            gNeedsLayout = true;
         }}
     };
 }
 
-void renderContextMenu() {
+// Draws the menu with its top-left corner at (x, y); see compositeLayer.
+void renderContextMenu(int x, int y) {
     if (!contextMenu.visible) return;
 
-    SDL_Rect rect = {contextMenu.x, contextMenu.y, contextMenu.width, contextMenu.height};
+    SDL_Rect rect = {x, y, contextMenu.width, contextMenu.height};
     SDL_SetRenderDrawColor(gRenderer, 50, 50, 50, 255);
     SDL_RenderFillRect(gRenderer, &rect);
 
     int itemHeight = 25;
     for (int i = 0; i < contextMenu.items.size(); ++i) {
         renderText(contextMenu.items[i].label,
-                   contextMenu.x + 5,
-                   contextMenu.y + i * itemHeight,
-                   { {255,255,255,255}, 18, "Arial.ttf" },
+                   x + 5,
+                   y + i * itemHeight,
+                   { {255,255,255,255}, 18, kDefaultFace },
                    contextMenu.width - 10, itemHeight);
     }
 }
@@ -483,95 +1528,497 @@ void handleContextMenuClick(int mouseX, int mouseY) {
     contextMenu.visible = false; // hide after click
 }
 
+size_t consoleBytes() {
+    size_t bytes = devConsole.inputBuffer.size();
+    for (const auto& line : devConsole.lines) bytes += sizeof(string) + line.size();
+    return bytes;
+}
+
+// The console keeps its last 100 lines, fewer if they outgrow its budget.
 void logToConsole(const string& msg) {
     devConsole.lines.push_back(msg);
     if (devConsole.lines.size() > 100) devConsole.lines.erase(devConsole.lines.begin());
+    size_t budget = gMemory.pool(MemPool::Console).budget;
+    while (budget && devConsole.lines.size() > 1 && consoleBytes() > budget) devConsole.lines.erase(devConsole.lines.begin());
+    gConsoleLayer.dirty = true;
 
 }
 
-void renderDevConsole();
+// --- Element events ---
+// Elements under (x, y), innermost first; an event bubbles out through them.
+vector<int> elementsAt(int x, int y) {
+    vector<int> hits;
+    gHitIndex.queryPoint(x, y, hits);
+    const auto& boxes = gHitIndex.boxes();
+    sort(hits.begin(), hits.end(), [&](int a, int b) {
+        return (long long)boxes[a].w * boxes[a].h < (long long)boxes[b].w * boxes[b].h;
+    });
+    vector<int> elements;
+    for (int i : hits)
+        if (find(elements.begin(), elements.end(), boxes[i].element) == elements.end())
+            elements.push_back(boxes[i].element);
+    return elements;
+}
 
-string promptConsole(const string& message) {
-    logToConsole(message);
-    devConsole.inputBuffer.clear();
-    devConsole.active = true;
+bool hasHandler(int element, const string& event) {
+    if (element < 0) return false;
+    auto it = gElementHandlers.find(gDisplayList.elements[element]);
+    if (it == gElementHandlers.end()) return false;
+    for (const auto& h : it->second) if (h.event == event) return true;
+    return false;
+}
 
-    // Wait for user input via keyboard events in main SDL loop
-    while (devConsole.inputBuffer.empty()) {
-        SDL_Event e;
-        while (SDL_PollEvent(&e)) {
-            if (e.type == SDL_TEXTINPUT) {
-                devConsole.inputBuffer += e.text.text;
-            }
-            else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_RETURN) {
-                return devConsole.inputBuffer;
+void runElementAction(const string& action) {
+    if (startsWith(action, "alert ") && gHeadless) {
+        cout << "alert: " << action.substr(6) << endl;
+    } else if (startsWith(action, "alert ")) {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, SDL_GetWindowTitle(gWindow), action.substr(6).c_str(), gWindow);
+    } else if (startsWith(action, "log ")) {
+        logToConsole("[" + SrcName + "]: " + action.substr(4));
+    }
+}
+
+void dispatchElementEvent(const string& event, int element) {
+    if (element < 0) return;
+    const string& id = gDisplayList.elements[element];
+    if (devConsole.active) logToConsole("[event] " + event + " #" + id);
+    auto it = gElementHandlers.find(id);
+    if (it == gElementHandlers.end()) return;
+    for (const auto& h : it->second)
+        if (h.event == event) runElementAction(h.action);
+}
+
+void handlePageClick(int x, int y) {
+    for (int element : elementsAt(x, y)) dispatchElementEvent("click", element);
+}
+
+void handlePageHover(int x, int y) {
+    static SDL_Cursor* arrow = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
+    static SDL_Cursor* hand = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_HAND);
+
+    int element = gHitIndex.hitTest(x, y);
+    if (element == gHoverElement) return;
+    dispatchElementEvent("mouseleave", gHoverElement);
+    dispatchElementEvent("mouseenter", element);
+    gHoverElement = element;
+
+    bool clickable = false;
+    for (int e : elementsAt(x, y)) clickable = clickable || hasHandler(e, "click");
+    SDL_SetCursor(clickable ? hand : arrow);
+}
+
+void renderDevConsole(int x, int y);
+
+// --- Script loop ---
+// Budget per frame for script work; the rest of a long script runs next frame.
+const double kScriptBudgetMs = 4.0;
+const double kFrameMs = 1000.0 / 60;
+
+// Reply callback of the prompt() waiting on the console input, if any.
+function<void(string)> gPendingPrompt;
+
+ScriptLoop gScripts({
+    [](const string& msg) { logToConsole("[" + SrcName + "]: " + msg + "\n"); },
+    [](const string& msg) { js_alert(msg, SDL_GetWindowTitle(gWindow)); },
+    [](const string& message, function<void(string)> reply) {
+        logToConsole(message);
+        if (gHeadless) {   // nobody to answer
+            reply("");
+            return;
+        }
+        devConsole.inputBuffer.clear();
+        devConsole.active = true;
+        gPendingPrompt = move(reply);   // answered by RETURN in the console
+    },
+    [](const string& src, function<void()> loaded) {
+        string path = src;
+        resolveImagePath(path);
+        whenLoaded(scriptResource(ResourceKind::Image, path), move(loaded));   // drawImage reuses its decode
+    },
+    // "draw <canvasID> <op>": marks the canvas dirty, so its tiles repaint.
+    [](const string& canvasId, const string& op) {
+        auto it = gCanvases.find(canvasId);
+        if (it == gCanvases.end()) {
+            cerr << "draw: no canvas " << canvasId << endl;
+            return;
+        }
+        CanvasImageSource images = [](const string& src, int& w, int& h) {
+            string path = src;
+            resolveImagePath(path);
+            return canvasImagePixels(path, w, h);
+        };
+        if (!runCanvasOp(it->second.canvas, op, images))
+            cerr << "draw: bad canvas op: " << op << endl;
+    },
+    // ".script src": the loader fetched and translated it, usually ahead of time.
+    [](const string& src, function<void(vector<string>)> reply) {
+        string path = src;
+        resolveImagePath(path);
+        Resource& res = scriptResource(ResourceKind::Script, path);
+        whenLoaded(res, [&res, reply = move(reply)] {
+            vector<string> lines;
+            istringstream in(res.text);
+            for (string line; getline(in, line);) lines.push_back(line);
+            if (!res.ok) logToConsole("Failed to load script " + res.url + ": " + res.error);
+            reply(move(lines));
+        });
+    },
+});
+
+// --- Memory budgets ---
+// Each cache reports its bytes to gMemory; fonts, tiles and images can also
+// give up their least recently used entry. The rest are only counted (and
+// the script loop and console keep to their own budgets).
+
+// Rough bytes of the document and its layout: lines, styles, display list
+// and the two hit indexes built from it.
+size_t layoutBytes() {
+    size_t bytes = 0;
+    for (const auto& line : gLines) bytes += sizeof(string) + line.size();
+    bytes += gStyles.size() * (sizeof(Style) + 2 * sizeof(string));
+    for (const auto& item : gDisplayList.items) bytes += sizeof(DisplayItem) + sizeof(HitBox) + item.text.size();
+    for (const auto& id : gDisplayList.elements) bytes += sizeof(string) + id.size();
+    bytes += gDisplayList.boxes.size() * 2 * sizeof(HitBox);
+    for (const auto& [id, handlers] : gElementHandlers) bytes += id.size() + handlers.size() * sizeof(ElementHandler);
+    return bytes;
+}
+
+// The least recently used entry of a map whose values have lastUsed, among
+// those `evictable` accepts.
+template <class Map, class Pred>
+typename Map::iterator leastRecentlyUsed(Map& map, Pred evictable) {
+    auto oldest = map.end();
+    for (auto it = map.begin(); it != map.end(); ++it)
+        if (evictable(it->second) && (oldest == map.end() || it->second.lastUsed < oldest->second.lastUsed)) oldest = it;
+    return oldest;
+}
+
+void initMemory() {
+    gMemory.defaultBudget(MemPool::Tiles, kTileBudgetBytes);
+    gScripts.heapLimit = gMemory.pool(MemPool::Script).budget;
+
+    gMemory.track(MemPool::Fonts, {
+        [](size_t& cpu, size_t&) { for (const auto& f : gFonts) if (f.font) cpu += f.bytes; },
+        [] {
+            uint64_t oldest = MemoryAccountant::kNoEntry;
+            for (const auto& f : gFonts) if (f.font) oldest = min(oldest, f.lastUsed);
+            return oldest;
+        },
+        [] {
+            FontEntry* oldest = nullptr;
+            for (auto& f : gFonts) if (f.font && (!oldest || f.lastUsed < oldest->lastUsed)) oldest = &f;
+            if (!oldest) return false;
+            TTF_CloseFont(oldest->font);
+            oldest->font = nullptr;   // fontHandle reopens it
+            return true;
+        },
+    });
+
+    gMemory.track(MemPool::Tiles, {
+        [](size_t&, size_t& gpu) {
+            gpu += gCompositor.bytes();
+            for (Layer* layer : {&gMenuLayer, &gConsoleLayer}) if (layer->texture) gpu += size_t(layer->w) * layer->h * 4;
+        },
+        [] {
+            auto it = leastRecentlyUsed(gCompositor.tiles, [](const Tile&) { return true; });
+            return it == gCompositor.tiles.end() ? MemoryAccountant::kNoEntry : it->second.lastUsed;
+        },
+        [] {
+            auto it = leastRecentlyUsed(gCompositor.tiles, [](const Tile&) { return true; });
+            if (it == gCompositor.tiles.end()) return false;
+            if (it->second.texture) SDL_DestroyTexture(it->second.texture);
+            gCompositor.tiles.erase(it);
+            return true;
+        },
+    });
+
+    // Uploaded levels on the GPU; drawImage sources and decodes waiting for
+    // upload on the CPU.
+    auto uploaded = [](const CachedImage& img) { return !img.levels.empty(); };
+    gMemory.track(MemPool::Images, {
+        [](size_t& cpu, size_t& gpu) {
+            for (const auto& [key, img] : gImages) gpu += img.textureBytes;
+            for (const auto& [path, img] : gCanvasSources) cpu += img.bytes();
+            for (const auto& [key, res] : gImageLoads) {
+                if (!res->done()) continue;
+                cpu += res->base.bytes();
+                for (const auto& level : res->levels) cpu += level.pixels.size() * 4;
             }
+        },
+        [uploaded] {
+            auto it = leastRecentlyUsed(gImages, uploaded);
+            return it == gImages.end() ? MemoryAccountant::kNoEntry : it->second.lastUsed;
+        },
+        [uploaded] {
+            auto it = leastRecentlyUsed(gImages, uploaded);
+            if (it == gImages.end()) return false;
+            CachedImage& img = it->second;
+            for (auto& level : img.levels) SDL_DestroyTexture(level.texture);
+            img.levels.clear();
+            img.textureBytes = 0;
+            img.evicted = true;   // renderImage fetches it again
+            return true;
+        },
+    });
+
+    gMemory.track(MemPool::Canvas, {[](size_t& cpu, size_t& gpu) {
+        for (const auto& [id, el] : gCanvases) {
+            cpu += el.canvas.pixels.size() * 4;
+            if (el.texture) gpu += size_t(el.canvas.width) * el.canvas.height * 4;
         }
-        SDL_Delay(16);
-    }
+    }});
+    gMemory.track(MemPool::Layout, {[](size_t& cpu, size_t&) { cpu += layoutBytes(); }});
+    gMemory.track(MemPool::Script, {[](size_t& cpu, size_t&) { cpu += gScripts.heapBytes(); }});
+    gMemory.track(MemPool::Console, {[](size_t& cpu, size_t&) { cpu += consoleBytes(); }});
+}
 
-    return devConsole.inputBuffer;
+// Once a frame, after compositing, so what is on screen counts as used.
+// Evictions are traced at most once a second.
+void enforceMemory() {
+    static int evicted = 0;
+    static Uint32 lastTrace = 0;
+    static bool wasOver = false;
+    evicted += gMemory.enforce(gFrame);
+    bool over = gMemory.overBudget();
+    Uint32 now = SDL_GetTicks();
+    if ((evicted && now - lastTrace >= 1000) || (over && !wasOver)) {
+        cout << "Memory: " << (over ? "over budget with only on-screen entries left" : "evicted " + to_string(evicted) + " entries")
+             << "; " << gMemory.summary() << "\n";
+        evicted = 0;
+        lastTrace = now;
+        gConsoleLayer.dirty = true;
+    }
+    wasOver = over;
 }
 
+// The dev console shows each frame's repaints; stdout gets them summed at
+// most once a second (scrolling and animated canvases repaint every frame),
+// and not at all under --perf.
+void traceRepaints() {
+    static int repainted = 0;
+    static Uint32 lastTrace = 0;
+    if (!gCompositor.repainted) return;
+    gConsoleLayer.dirty = true;   // its stats line changed
+    repainted += gCompositor.repainted;
+    Uint32 now = SDL_GetTicks();
+    if (gPerf || now - lastTrace < 1000) return;
+    cout << "Compositor: repainted " << repainted << " tiles, " << gCompositor.tiles.size() << " cached ("
+         << (gCompositor.bytes() >> 10) << " KB)\n";
+    repainted = 0;
+    lastTrace = now;
+}
 
-void renderDevConsole() {
+// Draws the console panel with its top-left corner at (x, top).
+void renderDevConsole(int x, int top) {
     if (!devConsole.active) return;
 
     SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND);
     SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, Uint8(0.8f * 255));
 
-    devConsole.width = 300;
-    devConsole.height = gWindowHeight;
-
-    SDL_Rect panel = {gWindowWidth - devConsole.width, 0, devConsole.width, devConsole.height};
+    SDL_Rect panel = {x, top, devConsole.width, devConsole.height};
     SDL_RenderFillRect(gRenderer, &panel);
 
+    // compositor stats
+    int y = top + 5;
+    int h = 0;
+    renderText("tiles: " + to_string(gCompositor.tiles.size()) + " cached (" + to_string(gCompositor.bytes() >> 10) +
+               " KB), " + to_string(gCompositor.repainted) + " repainted",
+               x + 5, y, { {150,150,150,255}, 14, kDefaultFace }, devConsole.width - 10, h);
+    y += 20;
+    renderText("images: " + to_string(gPageImages.textureBytes >> 10) + " KB of textures, " +
+               to_string((int64_t(gPageImages.nativeBytes) - int64_t(gPageImages.textureBytes)) / 1024) + " KB saved",
+               x + 5, y, { {150,150,150,255}, 14, kDefaultFace }, devConsole.width - 10, h);
+    y += 20;
+    char scriptStats[96];
+    snprintf(scriptStats, sizeof scriptStats, "script: %.1f ms, %zu tasks, %zu deferred",
+             gScripts.lastFrameMs, gScripts.liveTasks(), gScripts.deferred);
+    renderText(scriptStats, x + 5, y, { {150,150,150,255}, 14, kDefaultFace }, devConsole.width - 10, h);
+    y += 20;
+    ResourceLoader::Stats loads = gLoader.stats();
+    char loaderStats[128];
+    snprintf(loaderStats, sizeof loaderStats, "loader: %d/%d done, %d deduped, %zu KB, meaningful %.0f ms",
+             loads.done, loads.requested - loads.deduped, loads.deduped, loads.bytes >> 10, gPageLoad.meaningfulMs);
+    renderText(loaderStats, x + 5, y, { {150,150,150,255}, 14, kDefaultFace }, devConsole.width - 10, h);
+    y += 20;
+    renderText("memory: " + gMemory.summary() + ", " + to_string(gMemory.evictedTotal) + " evicted",
+               x + 5, y, { {150,150,150,255}, 14, kDefaultFace }, devConsole.width - 10, h);
+    y += h + 4;
+
     // render console lines
-    int y = 5;
     for (auto &line : devConsole.lines) {
-        renderText(line, gWindowWidth - devConsole.width + 5, y,
-                   { {255,255,255,255}, 16, "Arial.ttf" }, devConsole.width - 10, y);
+        renderText(line, x + 5, y,
+                   { {255,255,255,255}, 16, kDefaultFace }, devConsole.width - 10, h);
         y += 18;
     }
 
     // render input buffer (for prompt)
     renderText("> " + devConsole.inputBuffer,
-               gWindowWidth - devConsole.width + 5, devConsole.height - 25,
-               { {200,200,200,255}, 16, "Arial.ttf" }, devConsole.width - 10, y);
+               x + 5, top + devConsole.height - 25,
+               { {200,200,200,255}, 16, kDefaultFace }, devConsole.width - 10, h);
+}
+
+
+// --- Frame ---
+int gLayoutWidth = -1;   // window width of the current layout
+
+// One frame: pick up fetches, lay out if needed, run scripts, composite the
+// page and overlays. Returns the images still loading on screen.
+int drawFrame() {
+    SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255);
+    SDL_RenderClear(gRenderer);
+
+    PerfScope resourcesPhase(gPerf, "resources");
+    collectResources();                  // Finished fetches: images, scripts waiting on them
+    resourcesPhase.stop();
+    if (gNeedsLayout || gLayoutWidth != gWindowWidth) {
+        PerfScope phase(gPerf, "layout");
+        if (gRunScripts) gPendingPrompt = nullptr;
+        exec(gLines, gStyles, gWindowWidth, gRunScripts); // lay out, start script on (re)load
+        indexDisplayList(gDisplayList);
+        scrollBy(0);
+        gHoverElement = -1;
+        gNeedsLayout = false;
+        gRunScripts = false;
+        gLayoutWidth = gWindowWidth;
+    }
+    PerfScope scriptsPhase(gPerf, "scripts");
+    gScripts.runFrame(kScriptBudgetMs);  // Timers, rAF callbacks and resumed tasks
+    scriptsPhase.stop();
+    int imagesLoading = prioritizeImages(gDisplayList);
+    if (devConsole.active && !gScripts.idle()) gConsoleLayer.dirty = true;
+    PerfScope compositePhase(gPerf, "composite");
+    compositePage(gDisplayList);         // Cached tiles; repaints only invalid ones
+    compositePhase.stop();
+    traceRepaints();
+    enforceMemory();                     // Evict least recently used cache entries over budget
+    if (contextMenu.visible)             // Right-click menu layer
+        compositeLayer(gMenuLayer, contextMenu.x, contextMenu.y, contextMenu.width, contextMenu.height, renderContextMenu);
+    if (devConsole.active) {             // Dev Tools layer
+        devConsole.width = 300;
+        devConsole.height = gWindowHeight;
+        compositeLayer(gConsoleLayer, gWindowWidth - devConsole.width, 0, devConsole.width, devConsole.height, renderDevConsole);
+    }
+
+    SDL_RenderPresent(gRenderer);
+    return imagesLoading;
+}
+
+// --- Headless runs ---
+// Loads `page` as Refresh does, runs frames until its resources are in and
+// then scrolls it top to bottom, a screen per frame. Returns the frames
+// drawn, or -1 if the page does not open.
+int playPage(const string& page) {
+    infile = page;
+    PerfScope loadPhase(gPerf, "load");
+    if (!loadDocument(infile)) return -1;
+    loadPhase.stop();
+    startPageLoad(gLines);
+    gRunScripts = true;
+    gNeedsLayout = true;
+    gScrollY = 0;
+
+    auto start = chrono::steady_clock::now();
+    auto elapsedMs = [&] { return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(); };
+    int frames = 0;
+    for (; gPageLoad.loadedMs < 0 && elapsedMs() < 10000; ++frames) {
+        SDL_PumpEvents();
+        reportPageLoad(drawFrame());
+    }
+    for (int last = -1; gScrollY != last; ++frames) {
+        last = gScrollY;
+        scrollBy(gWindowHeight);
+        SDL_PumpEvents();
+        reportPageLoad(drawFrame());
+    }
+    return frames;
+}
+
+// render --stress <rounds> <file.ab>...: plays each page in turn, `rounds`
+// times over, with the memory budgets enforced as usual. Fails if a frame
+// stayed over budget.
+int runStress(int rounds, const vector<string>& pages) {
+    for (int round = 1; round <= rounds; ++round) {
+        for (const string& page : pages) {
+            auto start = chrono::steady_clock::now();
+            int frames = playPage(page);
+            if (frames < 0) return 1;
+            cout << "Stress " << round << "/" << rounds << ": " << page << " in " << frames << " frames, "
+                 << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms; "
+                 << gMemory.summary() << "\n";
+        }
+    }
+
+    cout << "Peak memory by pool:\n";
+    for (size_t i = 0; i < size_t(MemPool::Count); ++i) {
+        const auto& pool = gMemory.pool(MemPool(i));
+        cout << "  " << kMemPoolNames[i] << ": " << (pool.peak >> 10) << " KB peak, " << pool.evicted << " evicted";
+        if (pool.budget) cout << " (budget " << (pool.budget >> 10) << " KB)";
+        cout << "\n";
+    }
+    cout << "Peak total " << (gMemory.peakTotal >> 10) << " KB of " << (gMemory.budget >> 10) << " KB, "
+         << gMemory.evictedTotal << " evicted, " << gMemory.framesOverBudget << " frames over budget\n";
+    return gMemory.framesOverBudget > 0 ? 1 : 0;
 }
 
+// render --perf <runs> <file.ab>: plays the page once to warm up and `runs`
+// times measured, then prints the median of each frame phase, summed over
+// the frames of a run (see perf.h). Fetching and decoding run on the
+// loader's threads and count only as the frames that wait for them.
+int runPerf(int runs, const string& page) {
+    PerfRecorder perf("render/" + filesystem::path(page).stem().string());
+    gPerf = &perf;
+    for (int run = 0; run <= runs; ++run) {
+        perf.beginRun();
+        PerfScope total(&perf, "total");
+        if (playPage(page) < 0) return 1;
+    }
+    gPerf = nullptr;
+    perf.report(cout);
+    return 0;
+}
 
 // --- Main ---
 int main(int argc, char* argv[]) {
+    auto startTime = chrono::steady_clock::now();
     cout << filesystem::current_path() << endl;
     cout << "Astra Render - SDL2 Renderer\n";
 
-    if (argc != 2) {
-        cout << "Usage: " << argv[0] << " <file.ab>\n";
+    string mode = argc >= 4 ? argv[1] : "";
+    bool stress = mode == "--stress", perf = mode == "--perf" && argc == 4;
+    if (argc != 2 && !stress && !perf) {
+        cout << "Usage: " << argv[0] << " <file.ab>\n"
+             << "       " << argv[0] << " --stress <rounds> <file.ab>...\n"
+             << "       " << argv[0] << " --perf <runs> <file.ab>\n";
         return 1;
     }
-    infile = argv[1];
+    infile = argv[argc == 2 ? 1 : 3];
+    gHeadless = stress || perf;
 
     if (!initSDL()) return 1;
+    gCompositor.useTiles = SDL_RenderTargetSupported(gRenderer);
+    initLoader();
+    initMemory();
 
-    vector<string> lines;
-    ifstream file(argv[1]);
-    if (!file.is_open()) {
-        cerr << "Failed to open file: " << argv[1] << endl;
+    if (gHeadless) {
+        int runs = max(1, atoi(argv[2]));
+        int result = stress ? runStress(runs, vector<string>(argv + 3, argv + argc)) : runPerf(runs, infile);
         cleanupSDL();
-        return 1;
+        return result;
     }
 
-    string line;
-    while (getline(file, line)) lines.push_back(line);
-
-    // --- Pass 1: Parse styles
-    auto styles = parseStyles(lines);
+    // --- Pass 1: Load lines and parse styles (or map them from the cache)
+    if (!loadDocument(infile)) {
+        cleanupSDL();
+        return 1;
+    }
+    bool docCached = diskCache().hits > 0;
+    startPageLoad(gLines);   // fetches run while the first layout does
+    auto& styles = gStyles;
     cout << "Parsed " << styles.size() << " styles.\n";
     for (const auto& [id, style] : styles) {
         cout << "Style for " << id << ": colour("
              << int(style.colour.r) << "," << int(style.colour.g) << "," << int(style.colour.b) << "), "
-             << "fontSize(" << style.fontSize << "), ttf(" << style.ttf_path << ")\n";
+             << "fontSize(" << style.fontSize << "), ttf(" << gFontFaces[style.face] << ")\n";
     }
 
     // --- Background from body
@@ -586,12 +2033,13 @@ int main(int argc, char* argv[]) {
     // --- Pass 2: Render content
     bool running = true;
     SDL_Event e;
-    bool first = true;
+    bool firstFrame = true;
 
     // Enable text input for Dev Tools
     SDL_StartTextInput();
 
     while (running) {
+        auto frameStart = chrono::steady_clock::now();
         while (SDL_PollEvent(&e)) {
             switch (e.type) {
                 case SDL_QUIT:
@@ -602,31 +2050,55 @@ int main(int argc, char* argv[]) {
                     if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
                         gWindowWidth = e.window.data1;
                         gWindowHeight = e.window.data2;
+                        scrollBy(0);
                     }
                     break;
 
+                case SDL_RENDER_TARGETS_RESET:
+                case SDL_RENDER_DEVICE_RESET:
+                    releaseTiles(); // target contents are gone; repaint on demand
+                    break;
+
+                case SDL_MOUSEWHEEL:
+                    scrollBy(-e.wheel.y * 40);
+                    break;
+
                 case SDL_MOUSEBUTTONDOWN:
                     if (e.button.button == SDL_BUTTON_RIGHT) {
                         showContextMenu(e.button.x, e.button.y);
                     } else if (e.button.button == SDL_BUTTON_LEFT) {
-                        handleContextMenuClick(e.button.x, e.button.y);
+                        if (contextMenu.visible) {
+                            handleContextMenuClick(e.button.x, e.button.y);
+                        } else if (!devConsole.active || e.button.x < gWindowWidth - devConsole.width) {
+                            handlePageClick(e.button.x, e.button.y + gScrollY);
+                        }
                     }
                     break;
 
+                case SDL_MOUSEMOTION:
+                    handlePageHover(e.motion.x, e.motion.y + gScrollY);
+                    break;
+
                 case SDL_TEXTINPUT:
                     if (devConsole.active) {
                         devConsole.inputBuffer += e.text.text;
+                        gConsoleLayer.dirty = true;
                     }
                     break;
 
                 case SDL_KEYDOWN:
                     if (devConsole.active) {
+                        gConsoleLayer.dirty = true;
                         if (e.key.keysym.sym == SDLK_BACKSPACE && !devConsole.inputBuffer.empty()) {
                             devConsole.inputBuffer.pop_back();
                         } else if (e.key.keysym.sym == SDLK_RETURN) {
                             // Add input to console and clear buffer
                             logToConsole("> " + devConsole.inputBuffer);
-                            // Here you could store or process prompt responses
+                            if (gPendingPrompt) {   // resumes the script waiting in prompt()
+                                auto reply = move(gPendingPrompt);
+                                gPendingPrompt = nullptr;
+                                reply(devConsole.inputBuffer);
+                            }
                             devConsole.inputBuffer.clear();
                         }
                     }
@@ -634,18 +2106,23 @@ int main(int argc, char* argv[]) {
             }
         }
 
-        // --- Clear and render everything ---
-        SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255);
-        SDL_RenderClear(gRenderer);
-
-        exec(lines, styles, gWindowWidth, first);   // Your state machine rendering
-        renderContextMenu();                 // Draw right-click menu if visible
-        renderDevConsole();                  // Draw Dev Tools overlay if active
-        first = false;
+        int imagesLoading = drawFrame();
 
-        SDL_RenderPresent(gRenderer);
-
-        SDL_Delay(16);
+        if (firstFrame) {
+            // Cold vs warm start: compare runs with an empty and a filled cache.
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+            cout << "First frame after " << ms << " ms (document " << (docCached ? "cached" : "parsed")
+                 << ", cache hits " << diskCache().hits << ", misses " << diskCache().misses << ")\n";
+            firstFrame = false;
+        }
+        reportPageLoad(imagesLoading);
+
+        // Sleep off the rest of the frame, but wake for a timer due sooner.
+        double spent = chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+        double wait = kFrameMs - spent;
+        double timer = gScripts.nextTimerIn();
+        if (timer >= 0) wait = min(wait, timer);
+        if (wait > 0) SDL_Delay(Uint32(wait));
     }
 
     // Stop text input and cleanup SDL
@@ -0,0 +1,208 @@
+#pragma once
+
+// Shrinking decoded images to the size they are shown at.
+//
+// resampleBox is an area-averaging (box) filter for any ratio: each output
+// pixel is the mean of the source pixels under it, weighted by how much of
+// each it covers. It runs as two separable passes with integer weights, so
+// the SSE2 version (used unless ASTRA_SIMD=scalar) gives exactly the scalar
+// pixels. Pixels are premultiplied RGBA as in canvas.h, which keeps
+// transparent pixels from darkening the edges they are averaged into.
+//
+// buildMipChain uses the same filter for the half, quarter, ... size copies
+// kept for an image shown smaller than its layout size.
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "canvas.h"
+
+struct ImagePixels {
+    std::vector<uint32_t> pixels;
+    int w = 0, h = 0;
+};
+
+// Read-only pixels that several holders share without copying: a mapping of
+// the disk cache, or a decode. The memory lives until the last copy goes.
+struct SharedPixels {
+    std::shared_ptr<const uint32_t> data;   // nullptr when there are none
+    int w = 0, h = 0;
+
+    size_t bytes() const { return data ? size_t(w) * h * 4 : 0; }
+};
+
+namespace resample_detail {
+
+// Source pixels under each output pixel along one axis. Weights are overlaps
+// in units of 1/dstLen source pixel, so those of one output sum to srcLen.
+struct Taps {
+    std::vector<int> first, count, offset;
+    std::vector<int16_t> weights;   // count[o] entries from offset[o]
+};
+
+inline Taps makeTaps(int srcLen, int dstLen) {
+    Taps t;
+    t.first.resize(dstLen);
+    t.count.resize(dstLen);
+    t.offset.resize(dstLen);
+    for (int o = 0; o < dstLen; ++o) {
+        int64_t start = int64_t(o) * srcLen, end = start + srcLen;
+        int first = int(start / dstLen), last = int((end - 1) / dstLen);
+        t.first[o] = first;
+        t.count[o] = last - first + 1;
+        t.offset[o] = int(t.weights.size());
+        for (int i = first; i <= last; ++i) {
+            int64_t lo = std::max(start, int64_t(i) * dstLen), hi = std::min(end, int64_t(i + 1) * dstLen);
+            t.weights.push_back(int16_t(hi - lo));
+        }
+    }
+    return t;
+}
+
+// Rounded acc / div per channel, packed back into a pixel.
+inline uint32_t packMean(const uint32_t* acc, uint32_t div) {
+    uint32_t out = 0;
+    for (int c = 0; c < 4; ++c) out |= ((acc[c] + div / 2) / div) << (8 * c);
+    return out;
+}
+
+inline void horizontalScalar(const uint32_t* src, int sw, uint32_t* dst, int dw, const Taps& t) {
+    for (int o = 0; o < dw; ++o) {
+        uint32_t acc[4] = {};
+        const uint32_t* p = src + t.first[o];
+        const int16_t* w = &t.weights[t.offset[o]];
+        for (int k = 0; k < t.count[o]; ++k)
+            for (int c = 0; c < 4; ++c) acc[c] += ((p[k] >> (8 * c)) & 0xFF) * uint32_t(w[k]);
+        dst[o] = packMean(acc, uint32_t(sw));
+    }
+}
+
+// acc[x * 4 + c] += channel c of row[x] * weight
+inline void accumulateRowScalar(uint32_t* acc, const uint32_t* row, int n, uint32_t weight) {
+    for (int x = 0; x < n; ++x)
+        for (int c = 0; c < 4; ++c) acc[x * 4 + c] += ((row[x] >> (8 * c)) & 0xFF) * weight;
+}
+
+#ifdef ASTRA_X86_SIMD
+
+// Two pixels' channels interleaved for _mm_madd_epi16: [r0 r1 g0 g1 b0 b1 a0 a1].
+inline __m128i interleave(__m128i p0x16, __m128i p1x16) { return _mm_unpacklo_epi16(p0x16, p1x16); }
+
+inline __m128i pairWeights(int16_t w0, int16_t w1) {
+    return _mm_set1_epi32(int(uint16_t(w0)) | (int(uint16_t(w1)) << 16));
+}
+
+inline void horizontalSse2(const uint32_t* src, int sw, uint32_t* dst, int dw, const Taps& t) {
+    __m128i zero = _mm_setzero_si128();
+    alignas(16) uint32_t acc[4];
+    for (int o = 0; o < dw; ++o) {
+        const uint32_t* p = src + t.first[o];
+        const int16_t* w = &t.weights[t.offset[o]];
+        int n = t.count[o];
+        __m128i sum = zero;
+        int k = 0;
+        for (; k + 2 <= n; k += 2) {
+            __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(p[k])), zero);
+            __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(p[k + 1])), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(interleave(a, b), pairWeights(w[k], w[k + 1])));
+        }
+        if (k < n) {
+            __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(p[k])), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(interleave(a, zero), pairWeights(w[k], 0)));
+        }
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc), sum);
+        dst[o] = packMean(acc, uint32_t(sw));
+    }
+}
+
+// Adds two rows at once: acc += a * wa + b * wb, four pixels per step.
+inline void accumulateRowsSse2(uint32_t* acc, const uint32_t* a, const uint32_t* b, int n, int16_t wa, int16_t wb) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i w = pairWeights(wa, wb);
+    int x = 0;
+    for (; x + 4 <= n; x += 4) {
+        __m128i pa = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i pb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        __m128i alo = _mm_unpacklo_epi8(pa, zero), ahi = _mm_unpackhi_epi8(pa, zero);
+        __m128i blo = _mm_unpacklo_epi8(pb, zero), bhi = _mm_unpackhi_epi8(pb, zero);
+        __m128i sums[4] = {
+            _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), w), _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), w),
+            _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), w), _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), w),
+        };
+        for (int i = 0; i < 4; ++i) {
+            __m128i* dst = reinterpret_cast<__m128i*>(acc + (x + i) * 4);
+            _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), sums[i]));
+        }
+    }
+    accumulateRowScalar(acc + x * 4, a + x, n - x, uint32_t(wa));
+    accumulateRowScalar(acc + x * 4, b + x, n - x, uint32_t(wb));
+}
+
+#endif // ASTRA_X86_SIMD
+
+} // namespace resample_detail
+
+// Box-filter `src` (sw x sh) into `dst` (dw x dh). Meant for shrinking;
+// sizes are limited to 32767 so weights fit the 16-bit SIMD multiplies.
+inline bool resampleBox(const uint32_t* src, int sw, int sh, uint32_t* dst, int dw, int dh, bool simd = true) {
+    using namespace resample_detail;
+    if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0 || std::max({sw, sh, dw, dh}) > 32767) return false;
+#ifdef ASTRA_X86_SIMD
+    simd = simd && &bestKernels() != &scalarKernels();
+#else
+    simd = false;
+#endif
+    Taps tx = makeTaps(sw, dw), ty = makeTaps(sh, dh);
+
+    std::vector<uint32_t> rows(size_t(dw) * sh);   // horizontal pass
+    for (int y = 0; y < sh; ++y) {
+#ifdef ASTRA_X86_SIMD
+        if (simd) horizontalSse2(src + size_t(y) * sw, sw, &rows[size_t(y) * dw], dw, tx);
+        else
+#endif
+            horizontalScalar(src + size_t(y) * sw, sw, &rows[size_t(y) * dw], dw, tx);
+    }
+
+    std::vector<uint32_t> acc(size_t(dw) * 4);
+    for (int oy = 0; oy < dh; ++oy) {
+        std::fill(acc.begin(), acc.end(), 0);
+        const int16_t* w = &ty.weights[ty.offset[oy]];
+        const uint32_t* row = &rows[size_t(ty.first[oy]) * dw];
+        int n = ty.count[oy], k = 0;
+#ifdef ASTRA_X86_SIMD
+        if (simd)
+            for (; k + 2 <= n; k += 2)
+                accumulateRowsSse2(acc.data(), row + size_t(k) * dw, row + size_t(k + 1) * dw, dw, w[k], w[k + 1]);
+#endif
+        for (; k < n; ++k) accumulateRowScalar(acc.data(), row + size_t(k) * dw, dw, uint32_t(w[k]));
+        for (int x = 0; x < dw; ++x) dst[size_t(oy) * dw + x] = packMean(&acc[size_t(x) * 4], uint32_t(sh));
+    }
+    return true;
+}
+
+inline ImagePixels resampleBox(const ImagePixels& src, int dw, int dh) {
+    ImagePixels out;
+    out.pixels.resize(size_t(dw) * dh);
+    if (resampleBox(src.pixels.data(), src.w, src.h, out.pixels.data(), dw, dh)) {
+        out.w = dw;
+        out.h = dh;
+    } else {
+        out.pixels.clear();
+    }
+    return out;
+}
+
+// Half-size copies of `base` until `levels` images exist in total or a side
+// would drop below minSide. The result starts with `base` itself.
+inline std::vector<ImagePixels> buildMipChain(ImagePixels base, int levels, int minSide) {
+    std::vector<ImagePixels> chain;
+    chain.push_back(std::move(base));
+    while (int(chain.size()) < levels && std::min(chain.back().w, chain.back().h) / 2 >= minSide) {
+        ImagePixels next = resampleBox(chain.back(), chain.back().w / 2, chain.back().h / 2);
+        if (next.pixels.empty()) break;
+        chain.push_back(std::move(next));
+    }
+    return chain;
+}
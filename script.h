@@ -0,0 +1,469 @@
+#pragma once
+
+// Event loop for the .ab script subset.
+//
+// Each script (the document's top-level lines, or a callback run by a timer
+// or requestAnimationFrame) is a C++20 coroutine that interprets its lines.
+// Anything that has to wait -- prompt(), an image for drawImage, the end of
+// the frame budget -- is an awaitable that suspends the coroutine; the loop
+// resumes it from runFrame once the result is in. Nothing here blocks, so a
+// script can never stall a frame for longer than its budget plus one line.
+//
+// .ab script lines (see tags.h):
+//   log <text with \$var>      alert <text>     let <name> <value>
+//   prompt <name> <message>    draw <canvasId> <op>
+//   .func <name> ... .func end                  (callback body)
+//   timeout <func> <ms> [handle]   interval <func> <ms> [handle]
+//   raf <func>                     cancel <handle>
+//   .script src <path>         (runs the external script there, once loaded)
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <coroutine>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tags.h"
+
+// What scripts can do to the page; render fills these in.
+struct ScriptHost {
+    std::function<void(const std::string&)> log;
+    std::function<void(const std::string&)> alert;
+    std::function<void(const std::string& message, std::function<void(std::string)> reply)> prompt;
+    std::function<void(const std::string& path, std::function<void()> loaded)> loadImage;
+    std::function<void(const std::string& canvasId, const std::string& op)> draw;
+    // The .ab lines of an external script; an empty reply if it failed.
+    std::function<void(const std::string& path, std::function<void(std::vector<std::string>)> reply)> loadScript;
+};
+
+class ScriptLoop;
+
+// A running script. The loop owns the coroutine and destroys it once done.
+struct ScriptTask {
+    struct promise_type {
+        ScriptTask get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // A broken line ends that script only; the loop logs the error.
+        void unhandled_exception() { error = std::current_exception(); }
+        std::exception_ptr error;
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+class ScriptLoop {
+public:
+    explicit ScriptLoop(ScriptHost h) : host(std::move(h)) {}
+    ~ScriptLoop() { reset(); }
+
+    // Replace the running program: cancels every task, timer and frame
+    // callback of the old one, then queues the new top-level script.
+    void start(std::vector<std::string> lines) {
+        reset();
+        program = extractFunctions(std::move(lines));
+        spawn(program);
+    }
+
+    void reset() {
+        for (auto h : tasks) h.destroy();
+        tasks.clear();
+        ready.clear();
+        timers = {};
+        frameCallbacks.clear();
+        handles.clear();
+        liveTimers.clear();
+        functions.clear();
+        program.reset();
+        included.clear();
+        variables.clear();
+        codeBytes = variableBytes = 0;
+        ++generation;   // replies to awaits of the old tasks are dropped
+    }
+
+    // Run one frame's worth of script: requestAnimationFrame callbacks,
+    // timers that are due, then ready tasks until `budgetMs` is used up.
+    // Whatever is left over runs next frame.
+    void runFrame(double budgetMs) {
+        frameStart = now();
+        budget = budgetMs;
+
+        std::vector<std::string> callbacks;
+        callbacks.swap(frameCallbacks);
+        for (const auto& f : callbacks) call(f);
+
+        while (!timers.empty() && timers.top().due <= frameStart) {
+            Timer t = timers.top();
+            timers.pop();
+            if (!liveTimers.count(t.id)) continue;   // cleared
+            call(t.function);
+            if (t.interval > 0 && liveTimers.count(t.id)) {
+                t.due = std::max(t.due + t.interval, frameStart);
+                timers.push(t);
+            } else {
+                liveTimers.erase(t.id);
+            }
+        }
+        dropClearedTimers();
+
+        deferred = 0;
+        while (!ready.empty()) {
+            if (overBudget()) {
+                deferred = ready.size();
+                break;
+            }
+            auto h = ready.front();
+            ready.pop_front();
+            h.resume();
+            if (h.done()) {
+                reportError(h.promise().error);
+                tasks.erase(std::find(tasks.begin(), tasks.end(), h));
+                h.destroy();
+            }
+        }
+        lastFrameMs = now() - frameStart;
+    }
+
+    bool idle() const { return ready.empty() && liveTimers.empty() && frameCallbacks.empty(); }
+    bool wantsFrame() const { return !ready.empty() || !frameCallbacks.empty(); }
+
+    // Milliseconds until the next timer is due, or -1 if none.
+    double nextTimerIn() const { return timers.empty() ? -1 : std::max(0.0, timers.top().due - now()); }
+
+    // Stats for the dev console.
+    double lastFrameMs = 0;   // script time spent in the last runFrame
+    size_t deferred = 0;      // tasks pushed to the next frame by the budget
+    size_t liveTasks() const { return tasks.size(); }
+
+    // Bytes held by the program's lines and its variables. A let or prompt
+    // that would take it past heapLimit (0 = none) throws a RangeError,
+    // ending that script, instead of storing the value.
+    size_t heapBytes() const { return codeBytes + variableBytes; }
+    size_t heapLimit = 0;
+
+    std::function<double()> now = [] {
+        using namespace std::chrono;
+        return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+    };
+
+private:
+    using Handle = std::coroutine_handle<ScriptTask::promise_type>;
+    // Script lines, shared with the tasks running them: a function redefined
+    // by an included script must not pull its old body from under a task.
+    using Lines = std::shared_ptr<const std::vector<std::string>>;
+
+    struct Timer {
+        double due;
+        uint64_t seq;           // FIFO among equal due times
+        std::string function;
+        double interval;        // 0 for setTimeout
+        uint64_t id;
+        bool operator>(const Timer& o) const { return due != o.due ? due > o.due : seq > o.seq; }
+    };
+
+    // Suspends until the next frame; the task goes to the back of the queue.
+    struct Yield {
+        ScriptLoop& loop;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h) { loop.ready.push_back(h); }
+        void await_resume() const noexcept {}
+    };
+
+    struct PromptAwait {
+        ScriptLoop& loop;
+        std::string message;
+        std::string value;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h) {
+            uint64_t gen = loop.generation;
+            loop.host.prompt(message, [this, h, gen, &loop = loop](std::string reply) {
+                if (gen != loop.generation) return;
+                value = std::move(reply);
+                loop.ready.push_back(h);
+            });
+        }
+        std::string await_resume() { return std::move(value); }
+    };
+
+    struct ImageAwait {
+        ScriptLoop& loop;
+        std::string path;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h) {
+            uint64_t gen = loop.generation;
+            loop.host.loadImage(path, [h, gen, &loop = loop] {
+                if (gen == loop.generation) loop.ready.push_back(h);
+            });
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct ScriptAwait {
+        ScriptLoop& loop;
+        std::string path;
+        std::vector<std::string> lines;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h) {
+            uint64_t gen = loop.generation;
+            loop.host.loadScript(path, [this, h, gen, &loop = loop](std::vector<std::string> reply) {
+                if (gen != loop.generation) return;
+                lines = std::move(reply);
+                loop.ready.push_back(h);
+            });
+        }
+        std::vector<std::string> await_resume() { return std::move(lines); }
+    };
+
+    bool overBudget() const { return now() - frameStart >= budget; }
+
+    // Move ".func <name>" ... ".func end" blocks (nesting allowed) out of
+    // `lines` into `functions`; returns what is left.
+    Lines extractFunctions(std::vector<std::string> lines) {
+        std::vector<std::string> out;
+        std::vector<std::pair<std::string, std::vector<std::string>>> open;
+        for (auto& line : lines) {
+            std::string_view token, arg;
+            split(line, token, arg);
+            if (token == ".func") {
+                if (arg == "end") {
+                    if (open.empty()) continue;
+                    functions[open.back().first] = std::make_shared<const std::vector<std::string>>(std::move(open.back().second));
+                    open.pop_back();
+                } else {
+                    open.push_back({std::string(arg), {}});
+                }
+                continue;
+            }
+            codeBytes += sizeof(std::string) + line.size();
+            (open.empty() ? out : open.back().second).push_back(std::move(line));
+        }
+        return std::make_shared<const std::vector<std::string>>(std::move(out));
+    }
+
+    static size_t variableSize(const std::string& name, const std::string& value) {
+        return 2 * sizeof(std::string) + name.size() + value.size();
+    }
+
+    // Store a variable unless that breaks heapLimit.
+    bool setVariable(const std::string& name, std::string value) {
+        auto it = variables.find(name);
+        size_t old = it == variables.end() ? 0 : variableSize(name, it->second);
+        size_t next = variableSize(name, value);
+        if (heapLimit && heapBytes() - old + next > heapLimit) {
+            host.log("Uncaught RangeError: script heap over its " + std::to_string(heapLimit >> 10) + " KB budget");
+            return false;
+        }
+        variableBytes += next - old;
+        variables[name] = std::move(value);
+        return true;
+    }
+
+    static std::string_view trimmed(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+        return s;
+    }
+
+    static void split(std::string_view line, std::string_view& token, std::string_view& arg) {
+        line = trimmed(line);
+        size_t space = line.find(' ');
+        token = line.substr(0, space);
+        arg = space == std::string_view::npos ? std::string_view() : trimmed(line.substr(space + 1));
+    }
+
+    void spawn(Lines lines) {
+        Handle h = run(std::move(lines)).handle;
+        tasks.push_back(h);
+        ready.push_back(h);
+    }
+
+    void call(const std::string& function) {
+        auto it = functions.find(function);
+        if (it != functions.end()) spawn(it->second);
+        else host.log("Uncaught ReferenceError: " + function + " is not defined");
+    }
+
+    void reportError(std::exception_ptr error) {
+        if (!error) return;
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            host.log(std::string("Uncaught Error: ") + e.what());
+        } catch (...) {
+            host.log("Uncaught Error: unknown exception");
+        }
+    }
+
+    // Substitute "\$name" with the variable's value.
+    std::string expand(const std::string& text) const {
+        std::string out;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text.compare(i, 2, "\\$") != 0) {
+                out += text[i];
+                continue;
+            }
+            size_t end = i + 2;
+            while (end < text.size() && (isalnum((unsigned char)text[end]) || text[end] == '_')) ++end;
+            auto it = variables.find(text.substr(i + 2, end - i - 2));
+            if (it != variables.end()) out += it->second;
+            i = end - 1;
+        }
+        return out;
+    }
+
+    uint64_t addTimer(std::string_view arg, bool repeat) {
+        std::istringstream in{std::string(arg)};
+        std::string function, handle;
+        double ms = 0;
+        in >> function >> ms >> handle;
+        uint64_t id = ++timerIds;
+        timers.push({now() + std::max(0.0, ms), ++timerSeq, function, repeat ? std::max(ms, 1.0) : 0, id});
+        liveTimers.insert(id);
+        if (!handle.empty()) handles[handle] = id;
+        return id;
+    }
+
+    // A cleared timer stays in the heap until it comes due; pop those on top
+    // so timers.top() is one that will run (nextTimerIn).
+    void dropClearedTimers() {
+        while (!timers.empty() && !liveTimers.count(timers.top().id)) timers.pop();
+    }
+
+    // The interpreter. The task holds its own reference to every script it
+    // is in, so `line` stays valid across co_await even if a function is
+    // redefined meanwhile. An external script runs where its ".script src"
+    // line is, so `frames` is a stack of (script, next line).
+    ScriptTask run(Lines lines) {
+        std::vector<std::pair<Lines, size_t>> frames = {{std::move(lines), 0}};
+        while (!frames.empty()) {
+            if (frames.back().second == frames.back().first->size()) {
+                frames.pop_back();
+                continue;
+            }
+            const std::string& line = (*frames.back().first)[frames.back().second++];
+            if (overBudget()) {
+                Yield next{*this};
+                co_await next;
+            }
+
+            std::string_view token, view;
+            split(line, token, view);
+            const AbCommand* cmd = abCommand(token);
+            if (!cmd) continue;
+            std::string arg(view);
+
+            switch (cmd->id) {
+            case Ab::Log:
+                host.log(expand(arg));
+                break;
+
+            case Ab::Alert:
+                host.alert(arg);
+                break;
+
+            // "let name value" (conv) or "let name = value"
+            case Ab::Let: {
+                size_t sep = arg.find('=');
+                if (sep == std::string::npos) sep = arg.find(' ');
+                if (sep == std::string::npos) break;
+                std::string_view name = trimmed(std::string_view(arg).substr(0, sep));
+                std::string_view value = trimmed(std::string_view(arg).substr(sep + 1));
+                if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+                    value = value.substr(1, value.size() - 2);
+                if (!setVariable(std::string(name), std::string(value))) co_return;
+                break;
+            }
+
+            case Ab::Prompt: {
+                size_t space = arg.find(' ');
+                if (space == std::string::npos) break;
+                // Named awaiter: GCC 12 mis-destroys aggregate temporaries in co_await.
+                PromptAwait ask{*this, arg.substr(space + 1), {}};
+                std::string reply = co_await ask;
+                if (!setVariable(arg.substr(0, space), std::move(reply))) co_return;
+                break;
+            }
+
+            case Ab::Draw: {
+                size_t space = arg.find(' ');
+                if (space == std::string::npos) break;
+                std::string op = arg.substr(space + 1);
+                if (op.rfind("drawImage ", 0) == 0) {
+                    std::string path = op.substr(10, op.find(' ', 10) - 10);
+                    ImageAwait load{*this, path};
+                    co_await load;
+                }
+                host.draw(arg.substr(0, space), op);
+                break;
+            }
+
+            case Ab::Timeout:
+                addTimer(arg, false);
+                break;
+
+            case Ab::Interval:
+                addTimer(arg, true);
+                break;
+
+            case Ab::Raf:
+                frameCallbacks.push_back(arg);
+                break;
+
+            case Ab::Cancel: {
+                auto it = handles.find(arg);
+                if (it == handles.end()) break;
+                liveTimers.erase(it->second);
+                handles.erase(it);
+                dropClearedTimers();
+                break;
+            }
+
+            // ".script src <path>": wait for the loader, then run it inline.
+            case Ab::Script: {
+                if (arg.rfind("src ", 0) != 0) break;
+                std::string path(trimmed(std::string_view(arg).substr(4)));
+                auto it = included.find(path);
+                if (it == included.end()) {
+                    ScriptAwait load{*this, path, {}};
+                    std::vector<std::string> body = co_await load;
+                    if (body.empty()) break;
+                    it = included.find(path);   // another task may have loaded it meanwhile
+                    if (it == included.end()) it = included.emplace(path, extractFunctions(std::move(body))).first;
+                }
+                frames.push_back({it->second, 0});
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+    }
+
+    ScriptHost host;
+    Lines program;
+    std::map<std::string, Lines> included;   // external scripts by path
+    std::map<std::string, Lines> functions;
+    std::map<std::string, std::string> variables;   // script globals
+    std::vector<Handle> tasks;                      // every live coroutine
+    std::deque<Handle> ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::set<uint64_t> liveTimers;                  // ids in `timers` not cleared yet
+    std::map<std::string, uint64_t> handles;        // JS variable -> timer id
+    std::vector<std::string> frameCallbacks;        // requestAnimationFrame, next frame
+    uint64_t timerIds = 0, timerSeq = 0;
+    uint64_t generation = 0;
+    double frameStart = 0, budget = 1e9;
+    size_t codeBytes = 0, variableBytes = 0;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+// The .ab command registry shared by conv and render.
+//
+// Every element and directive of the .ab format has one row in kAbCommands:
+// the first token of its .ab line, the HTML tag conv maps to it (if any) and
+// the layout properties render applies to it. Both lookups (HTML tag -> row
+// and .ab token -> row) are compile-time perfect hashes, so dispatch costs
+// the same however many tags are supported. Adding an element means adding
+// a row here (and a case in exec if it needs more than the properties).
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "phash.h"
+
+enum class Ab : uint8_t {
+    // Elements: ".<token> start" / ".<token> end"
+    Doc, Html, Head, Body, Title, Styles, Header, H2, Para, Ul, Li, Strong, B, Em, I, Img, Script, Canvas,
+    // Directives: "<token> <argument>"
+    Txt, Id, Media, Desc, On, GenFrom, SrcHash, Log, Alert, Let, Prompt, Size, Draw, Func, Timeout, Interval, Raf, Cancel,
+    Stylesheet,
+};
+
+enum : uint8_t {
+    kAbElement = 1,   // has start/end lines and a state on the stack
+    kAbInline = 2,    // does not end the current run of inline text
+    kAbSpaced = 4,    // line spacing is added after its end
+    kAbScript = 8,    // run by the script loop (script.h), not by layout
+};
+
+// Font style bits; the values match SDL_ttf's TTF_STYLE_*.
+enum : uint8_t { kFontBold = 1, kFontItalic = 2 };
+
+struct AbCommand {
+    Ab id;
+    std::string_view token;   // first token of the .ab line
+    std::string_view html;    // HTML tag conv maps to it, "" if none
+    uint8_t flags;
+    int8_t indent;            // extra indent for children
+    int8_t fontSizeDelta;     // added to the text size inside it
+    uint8_t fontStyle;        // kFont* bits for text inside it
+};
+
+constexpr std::array<AbCommand, 37> kAbCommands = {{
+    // id          token       html      flags                              indent size style
+    {Ab::Doc,      ".Doc",     "",       kAbElement,                        0,     0,   0},
+    {Ab::Html,     ".html",    "html",   kAbElement,                        0,     0,   0},
+    {Ab::Head,     ".head",    "head",   kAbElement,                        0,     0,   0},
+    {Ab::Body,     ".body",    "body",   kAbElement,                        0,     0,   0},
+    {Ab::Title,    ".title",   "title",  kAbElement,                        0,     0,   0},
+    {Ab::Styles,   ".styles",  "style",  kAbElement,                        0,     0,   0},
+    {Ab::Header,   ".header",  "h1",     kAbElement,                        0,     8,   0},
+    {Ab::H2,       ".h2",      "h2",     kAbElement | kAbSpaced,            0,     6,   0},
+    {Ab::Para,     ".para",    "p",      kAbElement | kAbSpaced,            0,     0,   0},
+    {Ab::Ul,       ".ul",      "ul",     kAbElement,                        20,    0,   0},
+    {Ab::Li,       ".li",      "li",     kAbElement | kAbSpaced,            0,     0,   0},
+    {Ab::Strong,   ".strong",  "strong", kAbElement | kAbInline,            0,     0,   kFontBold},
+    {Ab::B,        ".b",       "b",      kAbElement | kAbInline,            0,     0,   kFontBold},
+    {Ab::Em,       ".em",      "em",     kAbElement | kAbInline,            0,     0,   kFontItalic},
+    {Ab::I,        ".i",       "i",      kAbElement | kAbInline,            0,     0,   kFontItalic},
+    {Ab::Img,      ".img",     "img",    kAbElement,                        0,     0,   0},
+    {Ab::Script,   ".script",  "script", kAbElement | kAbSpaced,            0,     0,   0},
+    {Ab::Canvas,   ".canvas",  "canvas", kAbElement,                        0,     0,   0},
+    {Ab::Txt,      ".txt",     "",       kAbInline,                         0,     0,   0},
+    {Ab::Id,       "ID:",      "",       kAbInline,                         0,     0,   0},
+    {Ab::Media,    ".media",   "",       0,                                 0,     0,   0},
+    {Ab::Desc,     ".desc",    "",       0,                                 0,     0,   0},
+    {Ab::On,       ".on",      "",       kAbInline,                         0,     0,   0},
+    {Ab::GenFrom,  "genFrom",  "",       0,                                 0,     0,   0},
+    {Ab::SrcHash,  "srcHash",  "",       0,                                 0,     0,   0},
+    {Ab::Log,      "log",      "",       kAbScript,                         0,     0,   0},
+    {Ab::Alert,    "alert",    "",       kAbScript,                         0,     0,   0},
+    {Ab::Let,      "let",      "",       kAbScript,                         0,     0,   0},
+    {Ab::Prompt,   "prompt",   "",       kAbScript,                         0,     0,   0},
+    {Ab::Size,     ".size",    "",       0,                                 0,     0,   0},
+    {Ab::Draw,     "draw",     "",       kAbScript,                         0,     0,   0},
+    {Ab::Func,     ".func",    "",       kAbScript,                         0,     0,   0},
+    {Ab::Timeout,  "timeout",  "",       kAbScript,                         0,     0,   0},
+    {Ab::Interval, "interval", "",       kAbScript,                         0,     0,   0},
+    {Ab::Raf,      "raf",      "",       kAbScript,                         0,     0,   0},
+    {Ab::Cancel,   "cancel",   "",       kAbScript,                         0,     0,   0},
+    {Ab::Stylesheet, ".stylesheet", "",  0,                                 0,     0,   0},
+}};
+
+namespace tags_detail {
+
+constexpr bool rowsInOrder() {
+    for (size_t i = 0; i < kAbCommands.size(); ++i)
+        if (size_t(kAbCommands[i].id) != i) return false;
+    return true;
+}
+static_assert(rowsInOrder(), "kAbCommands rows must follow the order of enum Ab");
+
+constexpr size_t htmlCount() {
+    size_t n = 0;
+    for (const auto& c : kAbCommands) n += !c.html.empty();
+    return n;
+}
+
+constexpr std::array<std::string_view, kAbCommands.size()> tokenKeys() {
+    std::array<std::string_view, kAbCommands.size()> keys{};
+    for (size_t i = 0; i < kAbCommands.size(); ++i) keys[i] = kAbCommands[i].token;
+    return keys;
+}
+
+constexpr std::array<std::string_view, htmlCount()> htmlKeys() {
+    std::array<std::string_view, htmlCount()> keys{};
+    size_t n = 0;
+    for (const auto& c : kAbCommands) if (!c.html.empty()) keys[n++] = c.html;
+    return keys;
+}
+
+// Row index for each entry of htmlKeys().
+constexpr std::array<uint8_t, htmlCount()> htmlRows() {
+    std::array<uint8_t, htmlCount()> rows{};
+    size_t n = 0;
+    for (size_t i = 0; i < kAbCommands.size(); ++i) if (!kAbCommands[i].html.empty()) rows[n++] = uint8_t(i);
+    return rows;
+}
+
+constexpr auto kTokenHash = buildPerfectHash<64, 16>(tokenKeys());
+constexpr auto kHtmlHash = buildPerfectHash<32, 8>(htmlKeys());
+constexpr auto kHtmlRows = htmlRows();
+
+} // namespace tags_detail
+
+// Row for the first token of an .ab line, or nullptr.
+constexpr const AbCommand* abCommand(std::string_view token) {
+    int idx = tags_detail::kTokenHash.find(token);
+    return idx < 0 ? nullptr : &kAbCommands[idx];
+}
+
+// Row for an HTML tag name, or nullptr for tags conv passes through as-is.
+constexpr const AbCommand* abForHtml(std::string_view tag) {
+    int idx = tags_detail::kHtmlHash.find(tag);
+    return idx < 0 ? nullptr : &kAbCommands[tags_detail::kHtmlRows[idx]];
+}
+
+static_assert(abForHtml("h1")->id == Ab::Header && abCommand(".para")->id == Ab::Para && !abCommand(".nope"),
+              "tag registry lookup is broken");
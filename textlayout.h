@@ -0,0 +1,257 @@
+#pragma once
+
+// Text measuring and line breaking for the layout pass.
+//
+// Glyph advances are measured once per (font, codepoint) and word widths once
+// per (font, word), so a page can be broken into line boxes without
+// rasterizing anything. Nothing in here depends on SDL: render.cpp plugs the
+// SDL_ttf metrics in through GlyphSource, bench.cpp plugs in a fixed table.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Decode one UTF-8 codepoint starting at s[i] and advance i past it.
+// Malformed bytes are returned as-is so measuring never stalls.
+inline uint32_t nextCodepoint(const std::string& s, size_t& i) {
+    unsigned char c = s[i++];
+    if (c < 0x80) return c;
+    int extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+    uint32_t cp = c & (0x3F >> extra);
+    for (int k = 0; k < extra && i < s.size(); ++k) {
+        unsigned char cc = s[i];
+        if ((cc & 0xC0) != 0x80) break;
+        cp = (cp << 6) | (cc & 0x3F);
+        ++i;
+    }
+    return cp;
+}
+
+// Collapse runs of whitespace to a single space, the way HTML does.
+inline std::string collapseWhitespace(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    bool pendingSpace = false;
+    for (char c : s) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pendingSpace = !out.empty();
+        } else {
+            if (pendingSpace) out += ' ';
+            pendingSpace = false;
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Per-font metrics provider. `font` is whatever id the caller interned.
+struct GlyphSource {
+    std::function<int(int font, uint32_t cp)> advance;
+    std::function<int(int font)> lineHeight;
+    std::function<int(int font)> ascent;
+};
+
+// Caches glyph advances and word widths on top of a GlyphSource.
+class TextMeasurer {
+public:
+    explicit TextMeasurer(GlyphSource source) : src(std::move(source)) {}
+
+    int advance(int font, uint32_t cp) {
+        FontMetrics& m = metrics(font);
+        if (cp < 128) {
+            if (m.ascii[cp] < 0) m.ascii[cp] = src.advance(font, cp);
+            return m.ascii[cp];
+        }
+        auto it = m.other.find(cp);
+        if (it != m.other.end()) return it->second;
+        int adv = src.advance(font, cp);
+        m.other.emplace(cp, adv);
+        return adv;
+    }
+
+    // Width of s[begin, end) in `font`, cached per word.
+    int wordWidth(int font, const std::string& s, size_t begin, size_t end) {
+        FontMetrics& m = metrics(font);
+        std::string word = s.substr(begin, end - begin);
+        auto it = m.words.find(word);
+        if (it != m.words.end()) return it->second;
+        int w = 0;
+        for (size_t i = begin; i < end;) w += advance(font, nextCodepoint(s, i));
+        m.words.emplace(std::move(word), w);
+        return w;
+    }
+
+    int lineHeight(int font) {
+        FontMetrics& m = metrics(font);
+        if (m.lineHeight < 0) m.lineHeight = src.lineHeight(font);
+        return m.lineHeight;
+    }
+
+    int ascent(int font) {
+        FontMetrics& m = metrics(font);
+        if (m.ascent < 0) m.ascent = src.ascent(font);
+        return m.ascent;
+    }
+
+    // Drop cached words (glyph advances stay); used when memory matters more.
+    void clearWords() {
+        for (auto& m : fonts) m.words.clear();
+    }
+
+    size_t cachedWords() const {
+        size_t n = 0;
+        for (auto& m : fonts) n += m.words.size();
+        return n;
+    }
+
+private:
+    struct FontMetrics {
+        std::array<int, 128> ascii;
+        std::unordered_map<uint32_t, int> other;
+        std::unordered_map<std::string, int> words;
+        int lineHeight = -1;
+        int ascent = -1;
+        FontMetrics() { ascii.fill(-1); }
+    };
+
+    FontMetrics& metrics(int font) {
+        if (font < 0) font = 0;
+        if ((size_t)font >= fonts.size()) fonts.resize(font + 1);
+        return fonts[font];
+    }
+
+    GlyphSource src;
+    std::vector<FontMetrics> fonts;
+};
+
+// One styled piece of inline text. `style` is an opaque index for the caller.
+struct TextRun {
+    std::string text;
+    int font;
+    int style;
+};
+
+// A contiguous slice of one run placed on a line.
+struct LineFragment {
+    int run;
+    size_t begin, end;   // byte range in runs[run].text
+    int x, y;            // y is the top of the glyph box, relative to the line
+    int width;
+};
+
+struct LineBox {
+    int y;               // relative to the top of the block
+    int width, height, ascent;
+    std::vector<LineFragment> fragments;
+};
+
+// Whether a space should be laid out between two adjacent runs. conv trims
+// text around inline tags, so the gap has to be put back here.
+inline bool needsRunGap(const std::string& prev, const std::string& next) {
+    if (prev.empty() || next.empty()) return false;
+    char c = next[0];
+    return !(c == '.' || c == ',' || c == ';' || c == ':' || c == '!' || c == '?' || c == ')');
+}
+
+// Greedy line breaking of `runs` into lines no wider than maxWidth.
+// Break opportunities are spaces; a word wider than a whole line is split
+// between codepoints.
+inline std::vector<LineBox> breakLines(const std::vector<TextRun>& runs, int maxWidth, TextMeasurer& m) {
+    std::vector<LineBox> lines;
+    if (maxWidth < 1) maxWidth = 1;
+
+    LineBox line{0, 0, 0, 0, {}};
+    int x = 0;
+    bool pendingGap = false;   // a space is owed before the next word
+    int gapFont = 0;
+
+    auto finishLine = [&]() {
+        for (auto& f : line.fragments) f.y = line.ascent - m.ascent(runs[f.run].font);
+        line.width = x;
+        lines.push_back(std::move(line));
+        int y = lines.back().y + lines.back().height;
+        line = LineBox{y, 0, 0, 0, {}};
+        x = 0;
+        pendingGap = false;
+    };
+
+    auto place = [&](int runIdx, size_t begin, size_t end, int width, bool joinsPrev) {
+        int font = runs[runIdx].font;
+        line.height = std::max(line.height, m.lineHeight(font));
+        line.ascent = std::max(line.ascent, m.ascent(font));
+        if (joinsPrev && !line.fragments.empty() && line.fragments.back().run == runIdx) {
+            LineFragment& f = line.fragments.back();
+            f.end = end;
+            f.width = x + width - f.x;
+        } else {
+            line.fragments.push_back({runIdx, begin, end, x, 0, width});
+        }
+        x += width;
+    };
+
+    for (int r = 0; r < (int)runs.size(); ++r) {
+        const std::string& text = runs[r].text;
+        int font = runs[r].font;
+        if (r > 0 && needsRunGap(runs[r - 1].text, text)) {
+            pendingGap = !line.fragments.empty();
+            gapFont = runs[r - 1].font;
+        }
+
+        size_t i = 0;
+        bool firstWordInRun = true;
+        while (i < text.size()) {
+            if (text[i] == ' ') {
+                pendingGap = !line.fragments.empty();
+                gapFont = font;
+                ++i;
+                continue;
+            }
+            size_t wordEnd = text.find(' ', i);
+            if (wordEnd == std::string::npos) wordEnd = text.size();
+
+            int w = m.wordWidth(font, text, i, wordEnd);
+            int gap = pendingGap ? m.advance(gapFont, ' ') : 0;
+
+            if (x + gap + w > maxWidth && !line.fragments.empty()) {
+                finishLine();
+                gap = 0;
+            }
+
+            if (w > maxWidth) {
+                // Overlong word: fill lines codepoint by codepoint.
+                size_t p = i;
+                while (p < wordEnd) {
+                    size_t start = p;
+                    int acc = 0;
+                    while (p < wordEnd) {
+                        size_t q = p;
+                        int a = m.advance(font, nextCodepoint(text, q));
+                        if (x + gap + acc + a > maxWidth && (acc > 0 || !line.fragments.empty())) break;
+                        acc += a;
+                        p = q;
+                    }
+                    if (p == start) { finishLine(); gap = 0; continue; }
+                    x += gap;
+                    place(r, start, p, acc, false);
+                    gap = 0;
+                    if (p < wordEnd) finishLine();
+                }
+            } else {
+                // A gap inside one run is part of that run's fragment text.
+                bool joins = pendingGap && gapFont == font && !firstWordInRun;
+                if (joins) place(r, i, wordEnd, gap + w, true);
+                else { x += gap; place(r, i, wordEnd, w, false); }
+            }
+
+            pendingGap = false;
+            firstWordInRun = false;
+            i = wordEnd;
+        }
+    }
+    if (!line.fragments.empty()) finishLine();
+    return lines;
+}